@@ -25,26 +25,37 @@
 #include "./Warspite.c"
 
 void pre_auton() {
+    buildFileIndex();
 }
 
 task autonomous() {
     control_t state;
     replay_t replay;
 
+    startTelemetry();
+
 	initReplayData(&replay);
-    initState(&replay);
-	loadAutonomous(&replay);
+    initState(&state);
+	loadReplayFromFile("replay", &replay, REPLAY_LAYOUT_WARSPITE);
+	if(!replay.loaded || !validateReplay(&replay)) {
+		initReplayData(&replay); // nothing to play
+	}
+
+	ticker_t ticker;
+	tickerStart(&ticker, snapshotFreq);
 
-	while(replay.streamIndex < replay.streamSize) {
-		replayToControlState(&replay);
+	while(!replayFinished(&replay)) {
+		replayToControl(&state, &replay);
 		controlLoopIteration(&state);
-		sleep((int)deltaT);
+		tickerWait(&ticker);
 	}
 
+	stopTelemetry();
 	stopAllMotorsCustom();
 }
 
 unsigned int currentTime = 0;
+unsigned char recordBuffer[REPLAY_BUFFER_SIZE];
 
 /* Max recording time in milliseconds.
  *
@@ -58,6 +69,8 @@ task usercontrol()
     control_t state;
     replay_t replay;
 
+    startTelemetry();
+
 	initState(&state);
 
 	clearLCDLine(0);
@@ -83,27 +96,35 @@ task usercontrol()
 
     resetState(&state);
 
+	initReplayBuffer(&replay, recordBuffer, REPLAY_FRAME_SIZE, REPLAY_LAYOUT_WARSPITE);
+	startReplayWriter(&replay);
+
+	ticker_t ticker;
+	tickerStart(&ticker, snapshotFreq);
+
 	while (true)
 	{
 		joystickToControl(&state);
 		controlLoopIteration(&state);
 
 		if(timelimit > 0) {
-			controlStateToReplay(&state, &replay);
-		}
+			controlToReplay(&state, &replay);
 
-		currentTime += (int)deltaT;
+			if(replayOverflowed(&replay)) {
+				break;
+			}
+		}
 
-		if((currentTime > timelimit) && (timelimit > 0)) {
+		if((tickerTimeAt(&ticker, ticker.ticks+1) > timelimit) && (timelimit > 0)) {
 			break;
 		}
 
-		sleep((int)deltaT);
+		tickerWait(&ticker);
+		currentTime = tickerTime(&ticker);
 	}
 
-	replay.streamSize = replay.streamIndex+1;
-
 	stopAllMotorsCustom();
+	stopReplayWriter();
 
 	bool doSave = false;
 	while(true) {
@@ -127,5 +148,5 @@ task usercontrol()
 		saveReplayToFile("replay", &replay);
 	}
 
-    RCFS_ReadVTOC();
+	stopTelemetry();
 }
@@ -19,19 +19,25 @@ struct control_t {
     int   clawCrossings;    // Number of times claw err has changed sign
 
     int speedLimit = 96;
+
+    control_map_t controls; // see bindControls()
 };
 
-/* Button -> Replay Bitfield mapping
- * Bit | Function
- *  0  | Arm Up (6U)
- *  1  | Arm Down (6D)
- *  2  | Claw Open (5U)
- *  3  | Claw Closed (5D)
- *  4  | <reserved>
- *  5  | <reserved>
- *  6  | <reserved>
- *  7  | <reserved>
- */
+/* Replayed controls, in frame order: sticks, then buttons from bit 0 up. */
+void bindControls(control_t* state) {
+    control_map_t* map = &state->controls;
+    initControlMap(map);
+
+    mapAxis(map, "left", &state->left);
+    mapAxis(map, "right", &state->right);
+
+    mapButton(map, "armUp", &state->armUp);          // 6U
+    mapButton(map, "armDown", &state->armDown);      // 6D
+    mapButton(map, "clawOpen", &state->clawOpen);    // 5U
+    mapButton(map, "clawClose", &state->clawClose);  // 5D
+}
+
+const int deadband      = 25;       // Sticks within this count as idle
 const float clawKp      = 45;       // Arm porportionality control constant
 const int clawCtrlSpeed = 32;       // Rate to add to claw target every loop iteration (in potentiometer units)
 const int clawOpenPos   = 1024;     // Potentiometer output when claw open
@@ -47,7 +53,7 @@ void clawControl(control_t* state) {
 
         motor[clawL] = -127;
         motor[clawR] = 127;
-    } else if(state->clawClosed) {
+    } else if(state->clawClose) {
         state->clawSP -= clawCtrlSpeed;
         state->clawSP = (state->clawSP < clawClosedPos) ? clawClosedPos : state->clawSP;
         state->clawCrossings = 0;
@@ -123,10 +129,11 @@ void resetState(control_t* state) {
     state->armUp = false;
     state->armDown = false;
     state->clawOpen = false;
-    state->clawClosed = false;
+    state->clawClose = false;
 }
 
 void initState(control_t* state) {
+    bindControls(state);
     resetState(state);
     state->clawErr = 0;
     state->clawLErr = 0;
@@ -146,26 +153,11 @@ void joystickToControl(control_t* state) {
 }
 
 void replayToControl(control_t* state, replay_t* replay) {
-    state->left = (signed char)readNextByte(replay);
-    state->right = (signed char)readNextByte(replay);
-
-    unsigned char btnState = readNextByte(replay);
-    state->armUp = TEST_BIT(btnState, 0);
-    state->armDown = TEST_BIT(btnState, 1);
-    state->clawOpen = TEST_BIT(btnState, 2);
-    state->clawClosed = TEST_BIT(btnState, 3);
+    replayToControls(&state->controls, replay);
 }
 
 void controlToReplay(control_t* state, replay_t* replay) {
-    writeByte(replay, (unsigned char)state->left);
-    writeByte(replay, (unsigned char)state->right);
-
-    unsigned char btnState = 0;
-    btnState |= (state->armUp ? 1 : 0)      << 0;
-    btnState |= (state->armDown ? 1 : 0)    << 1;
-    btnState |= (state->clawOpen ? 1 : 0)   << 2;
-    btnState |= (state->clawClosed ? 1 : 0) << 3;
-    writeByte(replay, btnState);
+    controlsToReplay(&state->controls, replay);
 }
 
 #endif /* end of include guard: WARSPITE_C */
@@ -13,6 +13,92 @@ int slowSpeedLimit = 48; // = 0.5 * fastSpeedLimit
 const bool limSwitchEnabled = true;
 const bool catStateEnabled = true;
 
+/*
+ * Closed-loop replay: recorded frames also carry how far each side of the
+ * drive and the gyro moved, and playback steers the drive back onto that
+ * trajectory on top of the recorded stick inputs.
+ */
+const bool recordSensors = true;
+bool closedLoopReplay = true;
+
+/*
+ * Replay playback speed, in percent of the recording's. Drive commands
+ * (sticks and manual turns) are scaled by the same amount so that the robot
+ * still covers the recorded distance, up to the speed limit.
+ */
+int replayRate = REPLAY_RATE_NORMAL;
+
+/*
+ * Control loop rate while recording, and so the frame rate of new replays.
+ * Held inputs cost next to nothing in the stream, but the sensor deltas of
+ * tracked frames change on most frames while the robot moves, so a replay
+ * grows almost in step with the rate: at 100 Hz, about 2.8 times the size
+ * at 30 Hz, and a full 61 s skills run with noisy sticks can run out of
+ * chunks (REPLAY_MAX_CHUNKS) and stop early. Replays recorded at 100 Hz
+ * play back exactly one frame per tick (see replayTickFreq).
+ */
+int recordFreq = 30;
+
+/*
+ * Control loop rate while playing a replay back. Faster than the replay was
+ * recorded at (older replays are 30 Hz), the sticks (and the tracked
+ * trajectory) are interpolated between frames instead of stepping once per
+ * frame; buttons still change on the tick their frame starts.
+ */
+int replayTickFreq = 100;
+
+/*
+ * Where to start replays, in ms into the recording (e.g. to try out just
+ * the end of a skills run). Playback starts from the last keyframe at or
+ * before it; see resumeReplay().
+ */
+long replayStartTime = 0;
+
+#define FRAME_SIZE_OPEN 3    /* sticks + buttons */
+#define FRAME_SIZE_TRACKED 6 /* + left / right encoder and gyro deltas */
+
+/* Sensor signs, such that a positive drive command moves each reading up. */
+const int trackLeftDir = 1;
+const int trackRightDir = -1;
+const int trackHeadingDir = 1;
+
+/* Correction gains, in 1/16ths of a motor unit per encoder tick / gyro tenth of error. */
+const int trackKp = 24;
+const int trackKh = 8;
+const int trackMaxCorrection = 48;
+
+/*
+ * Autonomous turn controller tuning (see turnArbitraryAngle() in
+ * CompetitionControl.c). Depends on this drive's motors, gearing and
+ * weight; setTurnTuning() holds the values for this robot. Angles are in
+ * tenths of a degree.
+ */
+struct turnTuning_t {
+	float maxRate;      /* tenths/s, cruise turn rate */
+	float accel;        /* tenths/s^2 */
+	float kV;           /* motor units per tenth/s of planned turn rate */
+	float kA;           /* motor units per tenth/s^2 of planned acceleration */
+	float kP;           /* motor units per tenth of error */
+	float kD;           /* motor units per tenth/s of error rate */
+	int tolerance;      /* tenths */
+	int settleMs;       /* time the error must stay within tolerance */
+	int timeoutMs;      /* time allowed to settle after the planned turn ends */
+};
+
+turnTuning_t turnTuning;
+
+void setTurnTuning(turnTuning_t* t) {
+	t->maxRate = 1100;
+	t->accel = 8000;
+	t->kV = 0.095;
+	t->kA = 0.0076;
+	t->kP = 0.6;
+	t->kD = 0.04;
+	t->tolerance = 10;
+	t->settleMs = 40;
+	t->timeoutMs = 500;
+}
+
 struct control_t {
 	signed char yAxis;	/* Raw Ch2 from stick */
 	signed char zAxis;	/* Raw Ch1 from stick */
@@ -30,8 +116,49 @@ struct control_t {
 
 	unsigned int catState;
     unsigned int speedLimit;
+    int driveScale;     /* percent; drive commands are scaled by this */
+
+    /* Closed-loop replay state (positions relative to the first frame). */
+    bool trackStarted;
+    bool tracking;      /* apply corrections this iteration */
+    int baseLeft, baseRight, baseHeading;
+    int trackLeft, trackRight, trackHeading;
+
+    /* Sticks as last written to a replay (see recordedAxis()). */
+    signed char recordY, recordZ;
+    control_map_t controls;         /* see bindControls() */
+
+    /* Interpolated playback, from the frame being played towards the next. */
+    signed char frameY, frameZ;     /* sticks of the frame being played */
+    signed char nextY, nextZ;       /* sticks of the next frame */
+    int nextLeft, nextRight, nextHeading;  /* sensor deltas of the next frame */
+    int phase;                      /* 0..REPLAY_PHASE_ONE-1 */
 };
 
+/*
+ * The controls recorded in a replay frame, in frame order (see
+ * control_map_t): the sticks, then the buttons on bits 0..7 of byte 2.
+ * Tracked frames carry the encoder and gyro deltas after them.
+ * When overdubbing, the forward stick takes over from the replay's and the
+ * turn stick adds to it, to straighten out a turn without redriving it.
+ */
+void bindControls(control_t* state) {
+	control_map_t* map = &state->controls;
+	initControlMap(map);
+
+	mapAxis(map, "yAxis", &state->yAxis, &state->recordY);
+	mapAxis(map, "zAxis", &state->zAxis, &state->recordZ, CONTROL_MERGE_ADD);
+
+	mapButton(map, "catUp", &state->catUp);          /* 6D */
+	mapButton(map, "catDown", &state->catDown);      /* 6U */
+	mapButton(map, "catReset", &state->catReset);    /* 7U */
+	mapButton(map, "hangUp", &state->hangUp);        /* 5U */
+	mapButton(map, "hangDown", &state->hangDown);    /* 5D */
+	mapButton(map, "turnRight", &state->turnRight);  /* 8U */
+	mapButton(map, "turnLeft", &state->turnLeft);    /* 8D */
+	mapButton(map, "slowDown", &state->slowDown);    /* 7L */
+}
+
 /* Reset state (for when switching from auto->driver) */
 void resetState(control_t* state) {
 	state->yAxis = 0;
@@ -47,10 +174,20 @@ void resetState(control_t* state) {
   state->slowDown = false;
 
   state->speedLimit = fastSpeedLimit;
+  state->driveScale = REPLAY_RATE_NORMAL;
+
+  state->trackStarted = false;
+  state->tracking = false;
+
+  state->recordY = state->recordZ = 0;
+
+  state->nextLeft = state->nextRight = state->nextHeading = 0;
+  state->phase = 0;
 }
 
 /* Completely initialize state (from preauto->auto) */
 void initState(control_t* state) {
+	bindControls(state);
 	resetState(state);
 	state->catState = 0;
     state->speedLimit = fastSpeedLimit;
@@ -99,16 +236,13 @@ void intakeReset(control_t* state) {
 		}
 }
 
-void fireRoutine() {
+const int fireTimeout = 50; /* ms to drive the catapult down for, at most, when firing */
+
+/* Start a shot: drive down until the catapult releases (see catState 3). */
+void startFiring(control_t* state) {
 	clearTimer(T4);
 	catapultDown();
-	while(true) {
-		if((sensorValue[catapultLim] == 0) || (time1[T4] > 50)) {
-			catapultStop();
-			return;
-		}
-		sleep(2);
-	}
+	state->catState = 3;
 }
 
 void fireControl(control_t* state) {
@@ -127,6 +261,8 @@ void fireControl(control_t* state) {
 		 * state 0 -> catapult moving to switch
 		 * state 1 -> catapult halted at switch
 		 * state 2 -> catapult ready to fire
+		 * state 3 -> catapult firing (driven down until the switch opens,
+		 *            or for fireTimeout ms; checked once per iteration)
 		 */
 		if(state->catState == 0) {
 			if(state->catDown) {
@@ -158,15 +294,26 @@ void fireControl(control_t* state) {
 			}
 		} else if(state->catState == 2) {
 			if(state->catDown) {
-				fireRoutine();
+				startFiring(state);
 			} else if(state->catUp) {
 				catapultUp();
 			} else {
 				catapultStop();
 			}
 
+			if(state->catState == 2 && sensorValue[catapultLim] == 0) {
+				state->catState = 0;
+			}
+		} else if(state->catState == 3) {
 			if(sensorValue[catapultLim] == 0) {
+				catapultStop();
 				state->catState = 0;
+			} else if(time1[T4] > fireTimeout) {
+				/* Didn't release: stop, and fire again if still held. */
+				catapultStop();
+				state->catState = 2;
+			} else {
+				catapultDown();
 			}
 		}
 	}
@@ -185,20 +332,25 @@ void hangControl(control_t* state) {
 void moveControl(control_t* state) {
 	if( state->turnLeft || state->turnRight ) {
 		/* Rotation inputs: */
-		motor[LBack] = motor[LFront] = (state->turnLeft ? -1*manualTurnOut : manualTurnOut);
-		motor[RBack] = motor[RFront] = (state->turnLeft ? manualTurnOut : -1*manualTurnOut);
+		short turnOut = (manualTurnOut * state->driveScale) / REPLAY_RATE_NORMAL;
+		motor[LBack] = motor[LFront] = (state->turnLeft ? -1*turnOut : turnOut);
+		motor[RBack] = motor[RFront] = (state->turnLeft ? turnOut : -1*turnOut);
 	} else {
-    /* Set speedlimit as appropriate: */
-    float speedMult = 1.0;
+    /*
+     * Set speedlimit as appropriate. Slow mode halves the output; integer
+     * division truncates toward zero like the (float) * 0.5 cast it replaces,
+     * without the soft-float calls.
+     */
+    short speedDiv = 1;
     if(state->slowDown) {
         state->speedLimit = fastSpeedLimit;
-        speedMult = 0.5;
+        speedDiv = 2;
     } else {
         state->speedLimit = fastSpeedLimit;
     }
 
-		short yAxis = (abs(state->yAxis) < deadband) ? 0 : -state->yAxis;
-		short zAxis = (abs(state->zAxis) < deadband) ? 0 : -state->zAxis;
+		short yAxis = (abs(state->yAxis) < deadband) ? 0 : (-state->yAxis * state->driveScale) / REPLAY_RATE_NORMAL;
+		short zAxis = (abs(state->zAxis) < deadband) ? 0 : (-state->zAxis * state->driveScale) / REPLAY_RATE_NORMAL;
 
 		short right = yAxis - zAxis;
 		short left = yAxis + zAxis;
@@ -206,9 +358,56 @@ void moveControl(control_t* state) {
 		right = (abs(right) > state->speedLimit) ? (sgn(right)*state->speedLimit) : right;
 		left = (abs(left) > state->speedLimit) ? (sgn(left)*state->speedLimit) : left;
 
-		motor[RFront] = motor[RBack] = (signed char)((float)right * speedMult);
-		motor[LFront] = motor[LBack] = (signed char)((float)left * speedMult);
+		motor[RFront] = motor[RBack] = (signed char)(right / speedDiv);
+		motor[LFront] = motor[LBack] = (signed char)(left / speedDiv);
+	}
+}
+
+int trackLeftPos() {
+	return SensorValue[leftEnc] * trackLeftDir;
+}
+
+int trackRightPos() {
+	return SensorValue[rightEnc] * trackRightDir;
+}
+
+int trackHeadingPos() {
+	return SensorValue[gyroSens] * trackHeadingDir;
+}
+
+void startTracking(control_t* state) {
+	state->baseLeft = trackLeftPos();
+	state->baseRight = trackRightPos();
+	state->baseHeading = trackHeadingPos();
+	state->trackLeft = state->trackRight = state->trackHeading = 0;
+	state->trackStarted = true;
+}
+
+int clampMagnitude(int x, int limit) {
+	return (x > limit) ? limit : ((x < -limit) ? -limit : x);
+}
+
+/* Push the drive toward the recorded trajectory (after moveControl). */
+void trackingControl(control_t* state) {
+	if(!state->tracking) {
+		return;
 	}
+
+	/* Part of the way to the next frame's position, when ticking faster than frames. */
+	int leftTarget = state->trackLeft + ((state->nextLeft * state->phase) / REPLAY_PHASE_ONE);
+	int rightTarget = state->trackRight + ((state->nextRight * state->phase) / REPLAY_PHASE_ONE);
+	int headingTarget = state->trackHeading + ((state->nextHeading * state->phase) / REPLAY_PHASE_ONE);
+
+	int leftErr = leftTarget - (trackLeftPos() - state->baseLeft);
+	int rightErr = rightTarget - (trackRightPos() - state->baseRight);
+	int headingErr = headingTarget - (trackHeadingPos() - state->baseHeading);
+
+	int turn = (trackKh * headingErr) / 16;
+	int leftOut = clampMagnitude(((trackKp * leftErr) / 16) + turn, trackMaxCorrection);
+	int rightOut = clampMagnitude(((trackKp * rightErr) / 16) - turn, trackMaxCorrection);
+
+	motor[LFront] = motor[LBack] = clampMagnitude(motor[LFront] + leftOut, 127);
+	motor[RFront] = motor[RBack] = clampMagnitude(motor[RFront] + rightOut, 127);
 }
 
 void controlLoopIteration(control_t* state) {
@@ -216,6 +415,7 @@ void controlLoopIteration(control_t* state) {
 	fireControl(state);
 	hangControl(state);
 	moveControl(state);
+	trackingControl(state);
 }
 
 void controllerToControlState(control_t* state) {
@@ -232,95 +432,302 @@ void controllerToControlState(control_t* state) {
     state->slowDown = (vexRT[Btn7L] > 0);
 }
 
+void addTrackedDeltas(control_t* state, unsigned char* frame, int frameSize) {
+	if(frameSize < FRAME_SIZE_TRACKED) {
+		return;
+	}
+
+	if(!state->trackStarted) {
+		startTracking(state);
+	}
+
+	int d = state->controls.size;
+	state->trackLeft += (signed char)frame[d];
+	state->trackRight += (signed char)frame[d+1];
+	state->trackHeading += (signed char)frame[d+2];
+	state->tracking = closedLoopReplay;
+}
+
 void replayToControlState(control_t* state, replay_t* replay) {
-	state->yAxis = (signed char)readNextByte(replay);
-	state->zAxis = (signed char)readNextByte(replay);
-
-	/* Bit | Button
-	 *  0  | Catapult Up (6D)
-	 *  1  | Catapult Down (6U)
-	 *  2  | Catapult Reset (7U)
-	 *  3  | Hang Up (5U)
-	 *  4  | Hang Down (5D)
-	 *  5  | Turn Right (8U)
-	 *  6  | Turn Left (8D)
-	 *  7  | Slow Down (7L)
-	 */
-	unsigned char buttonState = readNextByte(replay);
-
-	state->catUp = TEST_BIT(buttonState, 0);
-	state->catDown = TEST_BIT(buttonState, 1);
-	state->catReset = TEST_BIT(buttonState, 2);
-	state->hangUp = TEST_BIT(buttonState, 3);
-	state->hangDown = TEST_BIT(buttonState, 4);
-	state->turnRight = TEST_BIT(buttonState, 5);
-	state->turnLeft = TEST_BIT(buttonState, 6);
-	state->slowDown = TEST_BIT(buttonState, 7);
+	unsigned char frame[REPLAY_MAX_FRAME_SIZE];
+	readReplayFrame(replay, frame);
+	unpackControls(&state->controls, frame);
+	addTrackedDeltas(state, frame, replay->frameSize);
+}
+
+/*
+ * A stick value as moveControl() will see it: anything inside the deadband
+ * drives the same as 0, and while a turn button is held the sticks aren't
+ * read at all, so the last value recorded stands. Stick jitter that never
+ * reaches the motors then doesn't break up runs of held frames. Only
+ * equivalences that hold at any driveScale are used, so replays played
+ * faster or slower still get the same commands as the raw sticks would
+ * (except in between frames, when ticking faster than recordFreq).
+ */
+signed char recordedAxis(control_t* state, signed char value, signed char last) {
+	if(state->turnLeft || state->turnRight) {
+		return last;
+	}
+	return (abs(value) < deadband) ? 0 : value;
 }
 
 void controlStateToReplay(control_t* state, replay_t* replay) {
-	writeByte(replay, (unsigned char)state->yAxis);
-	writeByte(replay, (unsigned char)state->zAxis);
+	state->recordY = recordedAxis(state, state->yAxis, state->recordY);
+	state->recordZ = recordedAxis(state, state->zAxis, state->recordZ);
+
+	unsigned char frame[REPLAY_MAX_FRAME_SIZE];
+	packControls(&state->controls, frame);
+
+	if(replay->frameSize >= FRAME_SIZE_TRACKED) {
+		if(!state->trackStarted) {
+			startTracking(state);
+		}
+
+		/* Deltas are clamped to a byte; the clamped sum is what gets replayed. */
+		int dLeft = clampMagnitude((trackLeftPos() - state->baseLeft) - state->trackLeft, 127);
+		int dRight = clampMagnitude((trackRightPos() - state->baseRight) - state->trackRight, 127);
+		int dHeading = clampMagnitude((trackHeadingPos() - state->baseHeading) - state->trackHeading, 127);
+
+		state->trackLeft += dLeft;
+		state->trackRight += dRight;
+		state->trackHeading += dHeading;
 
-	unsigned char buttonState = 0;
-	buttonState |= (state->catUp ? 1 : 0);
-	buttonState |= (state->catDown ? 1 : 0) << 1;
-	buttonState |= (state->catReset ? 1 : 0) << 2;
-	buttonState |= (state->hangUp ? 1 : 0) << 3;
-	buttonState |= (state->hangDown ? 1 : 0) << 4;
-	buttonState |= (state->turnRight ? 1 : 0) << 5;
-	buttonState |= (state->turnLeft ? 1 : 0) << 6;
-	buttonState |= (state->slowDown ? 1 : 0) << 7;
+		int d = state->controls.size;
+		frame[d] = (unsigned char)dLeft;
+		frame[d+1] = (unsigned char)dRight;
+		frame[d+2] = (unsigned char)dHeading;
+	}
+
+	/* Saved with keyframes, for resumeReplay(). */
+	replay->keyState[0] = state->catState;
+	replay->keyState[1] = state->speedLimit;
+
+	writeReplayFrame(replay, frame);
+}
+
+/*
+ * Read the frames due this tick at the replay's playback rate and tick rate
+ * (see replayFramesDue()). Sticks come from the last of them; a button
+ * counts as pressed if it was in any of them, so short presses aren't lost;
+ * and sensor deltas add up. On ticks in between, only the interpolation
+ * towards the next frame moves on.
+ */
+void replayTickToControlState(control_t* state, replay_t* replay) {
+	int due = replayFramesDue(replay);
+	if(due > 0) {
+		unsigned char frame[REPLAY_MAX_FRAME_SIZE];
+		unsigned char pressed[REPLAY_MAX_FRAME_SIZE];
+		memset(pressed, 0, REPLAY_MAX_FRAME_SIZE);
+		for(int i=0;i<due;i++) {
+			readReplayFrame(replay, frame);
+			addTrackedDeltas(state, frame, replay->frameSize);
+			mergeButtons(&state->controls, pressed, frame);
+		}
+
+		mergeButtons(&state->controls, frame, pressed);
+		unpackControls(&state->controls, frame);
+		state->driveScale = replay->rate;
+
+		/* Frame order as in bindControls(). */
+		unsigned char next[REPLAY_MAX_FRAME_SIZE];
+		peekReplayFrame(replay, next);
+		state->frameY = state->yAxis;
+		state->frameZ = state->zAxis;
+		state->nextY = (signed char)next[0];
+		state->nextZ = (signed char)next[1];
+		if(replay->frameSize >= FRAME_SIZE_TRACKED && !replayFinished(replay)) {
+			int d = state->controls.size;
+			state->nextLeft = (signed char)next[d];
+			state->nextRight = (signed char)next[d+1];
+			state->nextHeading = (signed char)next[d+2];
+		} else {
+			state->nextLeft = state->nextRight = state->nextHeading = 0;
+		}
+	}
+
+	state->phase = replayFramePhase(replay);
+	state->yAxis = state->frameY + (((state->nextY - state->frameY) * state->phase) / REPLAY_PHASE_ONE);
+	state->zAxis = state->frameZ + (((state->nextZ - state->frameZ) * state->phase) / REPLAY_PHASE_ONE);
+}
+
+/*
+ * Overdubbing: play `replay` into `base`, a control_t of its own that never
+ * drives the robot (so that its sensor deltas don't get mixed up with the
+ * ones being recorded from `state`), and layer the driver's input in
+ * `state` over it (see bindControls()). Once the replay is over, only the
+ * driver's input is left.
+ */
+void overdubControlState(control_t* state, control_t* base, replay_t* replay) {
+	if(replayPlayedBack(replay)) {
+		resetState(base);
+	} else {
+		replayTickToControlState(base, replay);
+	}
+
+	mergeControls(&state->controls, &base->controls, deadband);
+}
 
-	writeByte(replay, buttonState);
+/* Frame size to record with. */
+int replayFrameSize() {
+	return recordSensors ? FRAME_SIZE_TRACKED : FRAME_SIZE_OPEN;
+}
+
+/* Playback time of `frames` frames, in ms, at the replay's playback rate. */
+long replayFramesTime(replay_t* replay, unsigned int frames) {
+    return ((long)frames * 1000 * REPLAY_RATE_NORMAL) / (replay->frameHz * replay->rate);
 }
 
 int getReplayTime(replay_t* replay) {
-    if(replay->streamSize > 0) {
-        int nReplayFrames = (replay->streamSize - 2) / 3;
-        return nReplayFrames * deltaT;
+    return replayFramesTime(replay, replay->frameCount);
+}
+
+/*
+ * Move `replay` to the last keyframe at or before `ms` into the recording,
+ * and put the catapult and speed limit back the way they were there. The
+ * catapult's timers start over; tracking starts again from wherever the
+ * robot is. Returns the playback time it resumes at, in ms. Replays without
+ * keyframes (recorded before they existed, or optimized from one that
+ * was) play from the start; the debug stream says which happened.
+ */
+long resumeReplay(control_t* state, replay_t* replay, long ms) {
+    unsigned int at = seekReplay(replay, (ms * replay->frameHz) / 1000);
+    if(replay->nKeyframes == 0) {
+        writeDebugStreamLine("Resume at %d ms: replay has no keyframes, playing from the start", (int)ms);
+    } else {
+        writeDebugStreamLine("Resume at %d ms: from the keyframe at %d ms", (int)ms, (int)(((long)at * 1000) / replay->frameHz));
     }
 
-    return 0;
+    if(at > 0) {
+        state->catState = replay->keyState[0];
+        state->speedLimit = replay->keyState[1];
+        clearTimer(T3);
+        clearTimer(T4);
+    }
+    state->trackStarted = false;
+    return replayFramesTime(replay, at);
 }
 
 bool doingReplayAuton = true;
 
-void loadAutonomous(replay_t* replay) {
-	int pos = sensorValue[autoSelector];
+/* Autonomous slots, in selector dial order. */
+#define AUTO_ILM_SKILLS 0
+#define AUTO_ILM_ROUTINE 1
+#define AUTO_OFF 2
+#define AUTO_SLOT1 3
+#define AUTO_SLOT2 4
+#define AUTO_SLOT3 5
+#define N_AUTO_SLOTS 6
 
+int autoSlotFromSelector(int pos) {
 	if(pos < 727) {		// Illuminati Skills
-		doingReplayAuton = false;
+		return AUTO_ILM_SKILLS;
 	} else if(pos < 1920) {	// Illuminati routine
-		doingReplayAuton = false;
+		return AUTO_ILM_ROUTINE;
 	} else if(pos < 2678) {	// Off
-   		 clearLCDLine(0);
-   		 displayLCDCenteredString(0, "Auto: None");
-
-		return;
+		return AUTO_OFF;
 	} else if(pos < 3200) {	// A1
-		writeDebugStreamLine("Loading: slot1");
-		loadReplayFromFile("slot1", replay);
-
-        clearLCDLine(0);
-        displayLCDCenteredString(0, "Auto: Slot 1");
+		return AUTO_SLOT1;
 	} else if(pos < 3768) { // A2
-		writeDebugStreamLine("Loading: slot2");
-		loadReplayFromFile("slot2", replay);
-
-        clearLCDLine(0);
-        displayLCDCenteredString(0, "Auto: Slot 2");
+		return AUTO_SLOT2;
 	} else if(pos > 4080) {	// A3
-		writeDebugStreamLine("Loading: slot3");
-		loadReplayFromFile("slot3", replay);
+		return AUTO_SLOT3;
+	}
+
+	return AUTO_OFF;
+}
+
+/* Replay file saved to / loaded from for each slot. */
+const char* autoSlotFile(int slot) {
+	if(slot == AUTO_ILM_SKILLS) {
+		return "ilmskills";
+	} else if(slot == AUTO_ILM_ROUTINE) {
+		return "ilmroutine";
+	} else if(slot == AUTO_SLOT1) {
+		return "slot1";
+	} else if(slot == AUTO_SLOT2) {
+		return "slot2";
+	} else if(slot == AUTO_SLOT3) {
+		return "slot3";
+	}
+
+	return NULL;
+}
+
+/*
+ * In competition the Illuminati slots run programmed routines rather than
+ * replays; the recorder still saves to and plays from them, so their files
+ * are preloaded like the others.
+ */
+bool autoSlotIsReplay(int slot) {
+	return (slot == AUTO_SLOT1) || (slot == AUTO_SLOT2) || (slot == AUTO_SLOT3);
+}
+
+replay_t autoReplays[N_AUTO_SLOTS];
+bool autoReplayReady[N_AUTO_SLOTS];
+
+/* Find and check the replay in one slot; again whenever it has been saved over. */
+void preloadSlot(int slot) {
+	initReplayData(&autoReplays[slot]);
+	autoReplayReady[slot] = false;
+
+	if(autoSlotFile(slot) != NULL) {
+		loadReplayFromFile(autoSlotFile(slot), &autoReplays[slot], REPLAY_LAYOUT_AKAGI);
+		autoReplayReady[slot] = autoReplays[slot].loaded && validateReplay(&autoReplays[slot]);
+
+		writeDebugStreamLine("Slot %s: %s", autoSlotFile(slot), autoReplayReady[slot] ? "ready" : "not ready");
+	}
+}
 
-        clearLCDLine(0);
-        displayLCDCenteredString(0, "Auto: Slot 3");
+/*
+ * Find and check every replay slot ahead of time (call from pre_auton), so
+ * that autonomous only has to pick one.
+ */
+void preloadAutonomous() {
+	for(int slot=0;slot<N_AUTO_SLOTS;slot++) {
+		preloadSlot(slot);
 	}
 
+	int slot = autoSlotFromSelector(sensorValue[autoSelector]);
+
+	clearLCDLine(0);
 	clearLCDLine(1);
-	displayLCDCenteredString(1, "Load done.");
-	writeDebugStreamLine("Loading done.");
+	if(slot == AUTO_ILM_SKILLS) {
+		displayLCDCenteredString(0, "Auto: Ilm Skills");
+	} else if(slot == AUTO_ILM_ROUTINE) {
+		displayLCDCenteredString(0, "Auto: Illuminati");
+	} else if(slot == AUTO_OFF) {
+		displayLCDCenteredString(0, "Auto: None");
+	} else if(slot == AUTO_SLOT1) {
+		displayLCDCenteredString(0, "Auto: Slot 1");
+	} else if(slot == AUTO_SLOT2) {
+		displayLCDCenteredString(0, "Auto: Slot 2");
+	} else if(slot == AUTO_SLOT3) {
+		displayLCDCenteredString(0, "Auto: Slot 3");
+	}
+
+	if(autoSlotIsReplay(slot)) {
+		displayLCDCenteredString(1, autoReplayReady[slot] ? "Load done." : "Not loaded!");
+	}
+}
+
+/*
+ * Pick the preloaded replay for the slot currently on the selector dial.
+ * Leaves `replay` empty if the slot has no (valid) replay.
+ */
+int selectAutonomous(replay_t* replay) {
+	int slot = autoSlotFromSelector(sensorValue[autoSelector]);
+
+	doingReplayAuton = !((slot == AUTO_ILM_SKILLS) || (slot == AUTO_ILM_ROUTINE));
+
+	if(autoReplayReady[slot]) {
+		memcpy(replay, &autoReplays[slot], sizeof(replay_t));
+	} else {
+		initReplayData(replay);
+	}
+	setReplayRate(replay, replayRate);
+	setReplayTickRate(replay, replayTickFreq);
+
+	return slot;
 }
 
 #endif /* end of include guard: AKAGI_C */
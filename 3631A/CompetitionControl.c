@@ -28,7 +28,11 @@
 
 #include "../Enterprise.c"
 #include "./Akagi.c"
+#ifdef ROBOTC_HOST
+#include "gyroLib2.c"
+#else
 #include "../RobotCLibs/gyroLib/gyroLib2.c"
+#endif
 /* Competition control stub. */
 
 bool enableLCD = false;
@@ -40,43 +44,41 @@ int currentTime = 0;
 int replayTime = 0;
 
 task lcdUpdate() {
-    while(true) {
-        clearLCDLine(1);
-
-        if(currentTime > 0) {
-            int sec = currentTime / 1000;
-            int ms = currentTime % 1000;
-
-            displayLCDString(1, 0, "Time: "); // length 5 (next char at 6)
+    lcdInvalidate();
 
-            /* Displays: ss.mmm (ss = seconds, mmm = milliseconds) */
-            displayLCDNumber(1, 6, sec, 2);
-            displayLCDChar(1, 8, '.');
-            displayLCDNumber(1, 9, sec, -3);
-        }
+    while(true) {
+        timingStart(&lcdTiming);
+        lcdClear(1);
 
+        /* Displays "ss.mmm / ss.mmm" against the replay length, else "Time: ss.mmm". */
         if(replayTime > 0) {
-            int sec = replayTime / 1000;
-            int ms = replayTime % 1000;
-
-            displayLCDString(1, 12, " / ");
-
-            displayLCDNumber(1, 15, sec, 2);
-            displayLCDChar(1, 17, '.');
-            displayLCDNumber(1, 18, sec, -3);
+            lcdPutTime(1, 0, currentTime);
+            lcdPutString(1, 6, " / ");
+            lcdPutTime(1, 9, replayTime);
+        } else if(currentTime > 0) {
+            lcdPutString(1, 0, "Time: ");
+            lcdPutTime(1, 6, currentTime);
         }
 
-        sleep(deltaT);
+        lcdRefresh();
+        timingStop(&lcdTiming);
+        sleep(lcdRefreshPeriod);
     }
 }
 
 task lcdUpdate2() {
-	string str;
+	lcdInvalidate();
+
 	while(true) {
-		sprintf(str,"Gyro %5.1f   ", theGyro.abs_angle );
-		clearLCDLine(0);
-    displayLCDString(0, 0, str);
-    sleep(50);
+		/* "Gyro -123.4" */
+		int tenths = theGyro.abs_angle * 10;
+
+		lcdClear(0);
+		lcdPutString(0, 0, "Gyro ");
+		lcdPutTenths(0, 5, tenths, 6);
+
+		lcdRefresh();
+		sleep(lcdRefreshPeriod);
 	}
 }
 
@@ -84,9 +86,10 @@ task lcdUpdate2() {
 void pre_auton() {
 	bStopTasksBetweenModes = true;
 
-    initReplayData(&replay);
-    loadAutonomous(&replay);
+    buildFileIndex();
+    preloadAutonomous();
 		initState(&state);
+    setTurnTuning(&turnTuning);
 
 
     if(enableLCD) {
@@ -110,10 +113,8 @@ const int rightEncCoeff = 1;
 const int gyroCoeff = -1;
 
 const int encDeadband = 20;
-const int gyroThreshold = 50;
 
 //const short driveSpeed = 45;
-const short turnSpeed = 65;
 
 int getLeftEncoder() {
 	return (SensorValue[leftEnc]*leftEncCoeff);
@@ -123,37 +124,180 @@ int getRightEncoder() {
 	return (SensorValue[rightEnc]*rightEncCoeff);
 }
 
-void driveStraightLine(float inches, short driveSpeed=45) {
-	short ticks = (inches * ticksPerInch);
+/*
+ * Straight-line moves follow a trapezoidal motion profile (accelerate,
+ * cruise, decelerate) in encoder ticks. Each side tracks the profile with
+ * velocity/acceleration feedforward plus PD on its own position error, and a
+ * synchronization term pulls the two sides toward each other so the robot
+ * stays straight while doing so.
+ */
+const int driveControlFreq = 100;       // Hz
+
+const float driveMaxTicksPerSec = 1050; // free speed at full power
+const float driveAccel = 2400;          // ticks/s^2
+
+const float driveKv = 0.121;            // motor units per tick/s   (= 127 / driveMaxTicksPerSec)
+const float driveKa = 0.0097;           // motor units per tick/s^2 (~ driveKv * motor time constant)
+const float driveKp = 1.2;              // motor units per tick of error
+const float driveKd = 0.05;             // motor units per tick/s of error
+const float driveKsync = 0.5;           // motor units per tick of left/right mismatch
+
+const int driveMotorDir = -1;           // a negative motor command moves the encoders forward
+const int driveSettleTicks = 6;         // final position tolerance
+const int driveSettleMs = 60;           // time both sides must stay in tolerance
+const int driveTimeoutMs = 750;         // time allowed to settle after the profile ends
+
+struct profile_t {
+	float distance;     // ticks (signed)
+	float accel;        // ticks/s^2
+	float peakVel;      // ticks/s, reached at the end of the accel phase
+	float tAccel;       // s, length of the accel (and decel) phase
+	float tCruise;      // s
+	float tTotal;       // s
+
+	/* Set by profileSample(): */
+	float pos, vel, acc;
+};
+
+void profileInit(profile_t* p, float distance, float maxVel, float accel) {
+	float d = abs(distance);
+
+	p->distance = distance;
+	p->accel = accel;
+
+	if(d < (maxVel * maxVel) / accel) {
+		/* Too short to reach cruise speed: triangular profile. */
+		p->peakVel = sqrt(d * accel);
+		p->tAccel = p->peakVel / accel;
+		p->tCruise = 0;
+	} else {
+		p->peakVel = maxVel;
+		p->tAccel = maxVel / accel;
+		p->tCruise = (d - (maxVel * maxVel) / accel) / maxVel;
+	}
+
+	p->tTotal = (2 * p->tAccel) + p->tCruise;
+	p->pos = p->vel = p->acc = 0;
+}
+
+void profileSample(profile_t* p, float t) {
+	float pos, vel, acc;
+
+	if(t <= 0) {
+		pos = vel = acc = 0;
+	} else if(t < p->tAccel) {
+		acc = p->accel;
+		vel = p->accel * t;
+		pos = 0.5 * p->accel * t * t;
+	} else if(t < (p->tAccel + p->tCruise)) {
+		float tc = t - p->tAccel;
+		acc = 0;
+		vel = p->peakVel;
+		pos = (0.5 * p->peakVel * p->tAccel) + (p->peakVel * tc);
+	} else if(t < p->tTotal) {
+		float tr = p->tTotal - t;
+		acc = -p->accel;
+		vel = p->accel * tr;
+		pos = abs(p->distance) - (0.5 * p->accel * tr * tr);
+	} else {
+		acc = vel = 0;
+		pos = abs(p->distance);
+	}
+
+	float dir = (p->distance < 0) ? -1 : 1;
+	p->pos = dir * pos;
+	p->vel = dir * vel;
+	p->acc = dir * acc;
+}
+
+/*
+ * No integral term: the feedforward leaves little steady error to remove,
+ * and in the plant model any Ki that helped a weak side wound up during
+ * the profile and overshot the end of the move.
+ */
+struct drivePd_t {
+	float lastError;
+};
+
+void drivePdReset(drivePd_t* pd) {
+	pd->lastError = 0;
+}
+
+/* Feedforward + PD output toward `p`'s current setpoint, in forward motor units. */
+float drivePdStep(drivePd_t* pd, profile_t* p, int measured, float dt) {
+	float error = p->pos - measured;
+
+	float derivative = (error - pd->lastError) / dt;
+	pd->lastError = error;
+
+	return (driveKv * p->vel) + (driveKa * p->acc) +
+		(driveKp * error) + (driveKd * derivative);
+}
+
+int clampMotor(float out) {
+	return (out > 127) ? 127 : ((out < -127) ? -127 : (int)out);
+}
+
+/*
+ * cruiseSpeed caps the profile's cruise speed, as the motor command that
+ * would hold it (127 = full speed). Before the profile, the second argument
+ * was the fixed motor command itself (driveSpeed, default 45).
+ */
+void driveStraightLine(float inches, short cruiseSpeed=100) {
+	profile_t profile;
+	drivePd_t leftPd, rightPd;
+
+	profileInit(&profile, inches * ticksPerInch, driveMaxTicksPerSec * abs(cruiseSpeed) / 127.0, driveAccel);
+	drivePdReset(&leftPd);
+	drivePdReset(&rightPd);
 
 	SensorValue[leftEnc] = 0;
 	SensorValue[rightEnc] = 0;
 
-	while( (abs(getLeftEncoder()-ticks) > encDeadband) &&
-				 (abs(getRightEncoder()-ticks) > encDeadband)) {
-		if(abs(getLeftEncoder()-ticks) > encDeadband) {
-			if(getLeftEncoder() < ticks) {
-				motor[LFront] = motor[LBack] = -driveSpeed;
+	float dt = 1.0 / driveControlFreq;
+	long settledSince = -1;
+
+	ticker_t ticker;
+	tickerStart(&ticker, driveControlFreq);
+
+	while(true) {
+		long now = tickerTime(&ticker);
+		int left = getLeftEncoder();
+		int right = getRightEncoder();
+
+		profileSample(&profile, now / 1000.0);
+
+		if(now >= (profile.tTotal * 1000)) {
+			if((abs(left - profile.pos) <= driveSettleTicks) && (abs(right - profile.pos) <= driveSettleTicks)) {
+				if(settledSince < 0) {
+					settledSince = now;
+				} else if((now - settledSince) >= driveSettleMs) {
+					break;
+				}
 			} else {
-				motor[LFront] = motor[LBack] = driveSpeed;
+				settledSince = -1;
 			}
-		} else {
-			motor[LFront] = motor[LBack] = 0;
-		}
 
-		if(abs(getRightEncoder()-ticks) > encDeadband) {
-			if(getRightEncoder() < ticks) {
-				motor[RFront] = motor[RBack] = -driveSpeed;
-			} else {
-				motor[RFront] = motor[RBack] = driveSpeed;
+			if(now >= ((profile.tTotal * 1000) + driveTimeoutMs)) {
+				break;
 			}
-		} else {
-			motor[RFront] = motor[RBack] = 0;
 		}
 
-		sleep(50);
+		float sync = driveKsync * (left - right);
+		float leftOut = drivePdStep(&leftPd, &profile, left, dt) - sync;
+		float rightOut = drivePdStep(&rightPd, &profile, right, dt) + sync;
+
+		motor[LFront] = motor[LBack] = clampMotor(driveMotorDir * leftOut);
+		motor[RFront] = motor[RBack] = clampMotor(driveMotorDir * rightOut);
+
+		tickerWait(&ticker);
 	}
 
+#ifdef DEBUG
+	writeDebugStreamLine("Drive %d ticks: left %d, right %d, %d ms (profile %d ms)", (int)profile.distance,
+		getLeftEncoder(), getRightEncoder(), (int)tickerTime(&ticker), (int)(profile.tTotal * 1000));
+#endif
+
 	motor[LFront] = motor[LBack] = 0;
 	motor[RFront] = motor[RBack] = 0;
 }
@@ -165,45 +309,75 @@ int getGyroAngle() {
 	return gyroCoeff*SensorValue[gyroSens];
 }
 
+/*
+ * Turns follow the same kind of trapezoidal profile as straight lines, in
+ * gyro tenths of a degree: feedforward on the planned turn rate and
+ * acceleration, plus PD on the heading error, so the drive ramps down
+ * into the target instead of overshooting it. The turn is done once the
+ * error has stayed within the tolerance for settleMs, or timeoutMs after the
+ * planned turn ends. The gains are in turnTuning (see the robot backend).
+ */
 void turnArbitraryAngle(int angle) {
-	while(abs(getGyroAngle() - angle) > gyroThreshold) {
-		if(getGyroAngle() < angle) {
-			motor[LFront] = motor[LBack] = -turnSpeed;
-			motor[RFront] = motor[RBack] = turnSpeed;
-		} else {
-			motor[LFront] = motor[LBack] = turnSpeed;
-			motor[RFront] = motor[RBack] = -turnSpeed;
+	profile_t profile;
+	int startAngle = getGyroAngle();
+	float dt = 1.0 / driveControlFreq;
+	float lastError = 0;
+	long settledSince = -1;
+
+	profileInit(&profile, angle - startAngle, turnTuning.maxRate, turnTuning.accel);
+
+	ticker_t ticker;
+	tickerStart(&ticker, driveControlFreq);
+
+	while(true) {
+		long now = tickerTime(&ticker);
+		int current = getGyroAngle();
+
+		profileSample(&profile, now / 1000.0);
+
+		float error = (startAngle + profile.pos) - current;
+
+		if(now >= (profile.tTotal * 1000)) {
+			if(abs(angle - current) <= turnTuning.tolerance) {
+				if(settledSince < 0) {
+					settledSince = now;
+				} else if((now - settledSince) >= turnTuning.settleMs) {
+					break;
+				}
+			} else {
+				settledSince = -1;
+			}
+
+			if(now >= ((profile.tTotal * 1000) + turnTuning.timeoutMs)) {
+				break;
+			}
 		}
-		sleep(25);
+
+		float out = (turnTuning.kV * profile.vel) + (turnTuning.kA * profile.acc) +
+			(turnTuning.kP * error) + (turnTuning.kD * (error - lastError) / dt);
+		lastError = error;
+
+		/* Positive output turns toward increasing getGyroAngle(). */
+		motor[LFront] = motor[LBack] = clampMotor(-out);
+		motor[RFront] = motor[RBack] = clampMotor(out);
+
+		tickerWait(&ticker);
 	}
 
+#ifdef DEBUG
+	writeDebugStreamLine("Turn to %d: reached %d in %d ms (profile %d ms)", angle, getGyroAngle(),
+		(int)tickerTime(&ticker), (int)(profile.tTotal * 1000));
+#endif
+
 	motor[LFront] = motor[LBack] = 0;
  	motor[RFront] = motor[RBack] = 0;
 }
 
 void turn90Right() {
-	/*
-	motor[LFront] = motor[LBack] = -turnSpeed;
- 	motor[RFront] = motor[RBack] = turnSpeed;
-
- 	sleep(500);
-
- 	motor[LFront] = motor[LBack] = 0;
- 	motor[RFront] = motor[RBack] = 0;
-	*/
 	turnArbitraryAngle(getGyroAngle()+900);
 }
 
 void turn90Left() {
-	/*
-	motor[LFront] = motor[LBack] = turnSpeed;
- 	motor[RFront] = motor[RBack] = -turnSpeed;
-
- 	sleep(500);
-
- 	motor[LFront] = motor[LBack] = 0;
- 	motor[RFront] = motor[RBack] = 0;
-	*/
 	turnArbitraryAngle(getGyroAngle()-900);
 }
 
@@ -253,18 +427,43 @@ void unlatch() {
 }
 
 task autonomous() {
+	long startTime = nSysTime;
+
+	startTelemetry();
+	selectAutonomous(&replay);
+
 	if(doingReplayAuton) {
-		currentTime = 0;    // current elapsed milliseconds
+		long resumedAt = 0;
+		if(replayStartTime > 0) {
+			resumedAt = resumeReplay(&state, &replay, replayStartTime);
+		}
+
+		currentTime = resumedAt;    // current elapsed milliseconds
 		replayTime = getReplayTime(&replay);
 
-		while(replay.streamIndex < replay.streamSize) {
-			replayToControlState(&state, &replay);
+		loopTimingReset();
+
+		ticker_t ticker;
+		tickerStart(&ticker, replay.tickHz);
+
+		while(!replayPlayedBack(&replay)) {
+			timingStart(&decodeTiming);
+			replayTickToControlState(&state, &replay);
+			timingStop(&decodeTiming);
+
+			timingStart(&controlTiming);
 			controlLoopIteration(&state);
+			timingStop(&controlTiming);
 
-			currentTime += (int)deltaT;
+			if(ticker.ticks == 0) {
+				writeDebugStreamLine("Autonomous start latency: %d ms", (int)(nSysTime - startTime));
+			}
 
-			sleep((int)deltaT);
+			tickerWait(&ticker);
+			currentTime = resumedAt + tickerTime(&ticker);
 		}
+
+		loopTimingReport(&ticker);
 	} else {
 		if(SensorValue[autoSelector] < 727) { // Ilm. Skills Auton
 			unlatch();
@@ -366,11 +565,14 @@ task autonomous() {
 		}
 	}
 
+	stopTelemetry();
 	stopAllMotorsCustom();
 }
 
 task usercontrol()
 {
+	startTelemetry();
+
 	if(enableLCD) {
         startTask(lcdUpdate);
     }
@@ -380,13 +582,27 @@ task usercontrol()
     currentTime = 0;
     replayTime = 0;
 
+	loopTimingReset();
+	bool reportHeld = false;
+
+	ticker_t ticker;
+	tickerStart(&ticker, snapshotFreq);
+
 	while (true)
 	{
 		controllerToControlState(&state);
+
+		timingStart(&controlTiming);
 		controlLoopIteration(&state);
+		timingStop(&controlTiming);
 
-        currentTime += (int)deltaT;
+		/* Center LCD button: dump loop timing to the debug stream. */
+		if((nLCDButtons & 0x02) && !reportHeld) {
+			loopTimingReport(&ticker);
+		}
+		reportHeld = (nLCDButtons & 0x02);
 
-		sleep((int)deltaT);
+		tickerWait(&ticker);
+		currentTime = tickerTime(&ticker);
 	}
 }
@@ -1,5 +1,5 @@
 #pragma config(I2C_Usage, I2C1, i2cSensors)
-#pragma config(Sensor, in1,    gyro,           sensorGyro)
+#pragma config(Sensor, in1,    gyroSens,       sensorGyro)
 #pragma config(Sensor, in2,    autoSelector,   sensorPotentiometer)
 #pragma config(Sensor, in3,    posSelector,    sensorPotentiometer)
 #pragma config(Sensor, dgtl1,  catapultLim,    sensorTouch)
@@ -39,7 +39,21 @@
  */
 unsigned int timelimit = 61000;
 
+/* Overdub mode.
+ *
+ *  When true, recording plays back the replay in the slot on the selector
+ *  dial and records it with the driver's input layered over it (see
+ *  overdubControlState()), so that one bad turn can be fixed without
+ *  redriving the whole routine. Save the result to any slot, that one
+ *  included: flash is only ever added to, so the replay being played back
+ *  stays intact.
+ */
+bool overdub = false;
+
 replay_t loadedReplay;
+unsigned char recordBuffer[REPLAY_BUFFER_SIZE];
+
+replay_t baseReplay;    /* being overdubbed */
 
 unsigned int currentTime = 0;
 unsigned int replayTime = 0;
@@ -48,113 +62,128 @@ bool recording = false;
 bool auton_mode = false;
 
 void saveAutonomous(replay_t* replay) {
-	int pos = sensorValue[autoSelector];
-
-	if(pos < 727) {		// Illuminati Skills
-		writeDebugStreamLine("Saving: ilmskills");
-		saveReplayToFile("ilmskills", replay);
-	} else if(pos < 1920) {	// Illuminati routine
-		writeDebugStreamLine("Saving: ilmroutine");
-		saveReplayToFile("ilmroutine", replay);
-	} else if(pos < 2678) {	// Off
+	int slot = autoSlotFromSelector(sensorValue[autoSelector]);
+	if(slot == AUTO_OFF) {
 		return;
-	} else if(pos < 3200) {	// A1
-		writeDebugStreamLine("Saving: slot1");
-		saveReplayToFile("slot1", replay);
-	} else if(pos < 3768) { // A2
-		writeDebugStreamLine("Saving: slot2");
-		saveReplayToFile("slot2", replay);
-	} else if(pos > 4080) {	// A3
-		writeDebugStreamLine("Saving: slot3");
-		saveReplayToFile("slot3", replay);
 	}
 
+	writeDebugStreamLine("Saving: %s", autoSlotFile(slot));
+	saveReplayToFile(autoSlotFile(slot), replay);
+	preloadSlot(slot); // what the next autonomous (or overdub) plays
+
 	clearLCDLine(0);
-	displayLCDCenteredString(0, "Save done.");
+	if(!autoReplayReady[slot]) {
+		displayLCDCenteredString(0, "Save failed!");
+	} else {
+		displayLCDCenteredString(0, "Save done.");
+	}
 	writeDebugStreamLine("Saving done.");
 }
 
 task lcdUpdate() {
-    while(true) {
-        clearLCDLine(1);
-
-        if(currentTime > 0) {
-            int sec = currentTime / 1000;
-            int ms = currentTime % 1000;
-
-            displayLCDString(1, 0, "Time: "); // length 5 (next char at 6)
+    lcdInvalidate();
 
-            /* Displays: ss.mmm (ss = seconds, mmm = milliseconds) */
-            displayLCDNumber(1, 6, sec, 2);
-            displayLCDChar(1, 8, '.');
-            displayLCDNumber(1, 9, ms, -3);
-        }
+    while(true) {
+        timingStart(&lcdTiming);
+        lcdClear(1);
 
+        /* Displays "ss.mmm / ss.mmm" against the time limit or replay length, else "Time: ss.mmm". */
+        unsigned int total = 0;
         if(recording && timelimit > 0) {
-            int sec = timelimit / 1000;
-            int ms = timelimit % 1000;
-
-            displayLCDString(1, 12, " / ");
-
-            displayLCDNumber(1, 15, sec, 2);
-            displayLCDChar(1, 17, '.');
-            displayLCDNumber(1, 18, ms, -3);
+            total = timelimit;
+        } else if(auton_mode && replayTime > 0) {
+            total = replayTime;
         }
 
-        if(auton_mode && replayTime > 0) {
-            int sec = replayTime / 1000;
-            int ms = replayTime % 1000;
-
-            displayLCDString(1, 12, " / ");
-
-            displayLCDNumber(1, 15, sec, 2);
-            displayLCDChar(1, 17, '.');
-            displayLCDNumber(1, 18, ms, -3);
+        if(total > 0) {
+            lcdPutTime(1, 0, currentTime);
+            lcdPutString(1, 6, " / ");
+            lcdPutTime(1, 9, total);
+        } else if(currentTime > 0) {
+            lcdPutString(1, 0, "Time: ");
+            lcdPutTime(1, 6, currentTime);
         }
 
-        sleep(deltaT);
+        lcdRefresh();
+        timingStop(&lcdTiming);
+        sleep(lcdRefreshPeriod);
     }
 }
 
-void pre_auton() {}
+void pre_auton() {
+    buildFileIndex();
+    preloadAutonomous();
+}
 
 task autonomous() {
+    long startTime = nSysTime;
     control_t state;
 
-	initReplayData(&loadedReplay);
+    startTelemetry();
+
     initState(&state);
-	loadAutonomous(&loadedReplay);
+	selectAutonomous(&loadedReplay);
+
+    long resumedAt = 0;
+    if(replayStartTime > 0) {
+        resumedAt = resumeReplay(&state, &loadedReplay, replayStartTime);
+    }
 
     auton_mode = true;
     recording = false;
     replayTime = getReplayTime(&loadedReplay);
-    currentTime = 0;
+    currentTime = resumedAt;
 
+    loopTimingReset();
     startTask(lcdUpdate);
 
-	while(loadedReplay.streamIndex < loadedReplay.streamSize) {
-		replayToControlState(&state, &loadedReplay);
+    ticker_t ticker;
+    tickerStart(&ticker, loadedReplay.tickHz);
+
+	while(!replayPlayedBack(&loadedReplay)) {
+		timingStart(&decodeTiming);
+		replayTickToControlState(&state, &loadedReplay);
+		timingStop(&decodeTiming);
+
+		timingStart(&controlTiming);
 		controlLoopIteration(&state);
+		timingStop(&controlTiming);
 
-        currentTime += (int)deltaT;
+		if(ticker.ticks == 0) {
+			writeDebugStreamLine("Autonomous start latency: %d ms", (int)(nSysTime - startTime));
+		}
 
-		sleep((int)deltaT);
+		tickerWait(&ticker);
+        currentTime = resumedAt + tickerTime(&ticker);
 	}
 
     stopTask(lcdUpdate);
+    stopTelemetry();
+#ifdef DEBUG
+    loopTimingReport(&ticker);
+#endif
 	stopAllMotorsCustom();
 }
 
 task usercontrol()
 {
     control_t state;
+    control_t base;
+
+    startTelemetry();
 
 	initState(&state);
-	initReplayData(&loadedReplay);
+	initState(&base);
+
+	if(overdub) {
+		selectAutonomous(&baseReplay);
+		setReplayRate(&baseReplay, REPLAY_RATE_NORMAL);
+		setReplayTickRate(&baseReplay, recordFreq);
+	}
 
 	clearLCDLine(0);
 	clearLCDLine(1);
-	displayLCDCenteredString(0, "Ready to record.");
+	displayLCDCenteredString(0, overdub ? "Ready to dub." : "Ready to record.");
 	displayLCDCenteredString(1, "Do stuff.");
 
 	while (true)
@@ -174,7 +203,7 @@ task usercontrol()
 	}
 
 	clearLCDLine(0);
-	displayLCDCenteredString(0, "Recording...");
+	displayLCDCenteredString(0, overdub ? "Overdubbing..." : "Recording...");
 
     recording = true;
     auton_mode = false;
@@ -182,35 +211,62 @@ task usercontrol()
     currentTime = 0;
 
     resetState(&state);
+    loopTimingReset();
     startTask(lcdUpdate);
 
+	initReplayBuffer(&loadedReplay, recordBuffer, replayFrameSize(), REPLAY_LAYOUT_AKAGI);
+	setReplayFrameRate(&loadedReplay, recordFreq);
+	setReplayKeyframeInterval(&loadedReplay, recordFreq); // one a second
+	startReplayWriter(&loadedReplay);
+
+    ticker_t ticker;
+    tickerStart(&ticker, recordFreq);
+
 	while (true)
 	{
 		controllerToControlState(&state);
+
+		if(overdub) {
+			timingStart(&decodeTiming);
+			overdubControlState(&state, &base, &baseReplay);
+			timingStop(&decodeTiming);
+		}
+
+		timingStart(&controlTiming);
 		controlLoopIteration(&state);
+		timingStop(&controlTiming);
 
 		if(timelimit > 0) {
+			timingStart(&encodeTiming);
 			controlStateToReplay(&state, &loadedReplay);
-		}
+			timingStop(&encodeTiming);
 
-		currentTime += (int)deltaT;
+			if(replayOverflowed(&loadedReplay)) {
+				clearLCDLine(0);
+				displayLCDCenteredString(0, "Recording full!");
+				break;
+			}
+		}
 
 		if(vexRT[Btn7R]) {
 			break;
 		}
 
-
-		if((currentTime > timelimit) && (timelimit > 0)) {
+		if((tickerTimeAt(&ticker, ticker.ticks+1) > timelimit) && (timelimit > 0)) {
 			break;
 		}
 
-		sleep((int)deltaT);
+		tickerWait(&ticker);
+		currentTime = tickerTime(&ticker);
 	}
 
-	loadedReplay.streamSize = loadedReplay.streamIndex+1;
+#ifdef DEBUG
+	loopTimingReport(&ticker);
+#endif
 
 	stopAllMotorsCustom();
     stopTask(lcdUpdate);
+	stopReplayWriter();
 
 	bool doSave = false;
 	while(true) {
@@ -234,5 +290,5 @@ task usercontrol()
 		saveAutonomous(&loadedReplay);
 	}
 
-    RCFS_ReadVTOC();
+	stopTelemetry();
 }
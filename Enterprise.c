@@ -2,135 +2,1743 @@
 #define ENTERPRISE_C
 
 #define MAX_FLASH_FILE_SIZE 10810
+#ifdef ROBOTC_HOST
+#include "FlashLib.h"
+#else
 #include "./rcfs/FlashLib.h"
+#endif
+
+const float snapshotFreq = 30; // Hz
+const float deltaT = (1/snapshotFreq) * 1000; // time between snapshots in milliseconds
+
+#define TEST_BIT(x, i) (((x)&(1<<(i))) > 0)
+
+/*
+ * Timing statistics.
+ *
+ * A timing_t accumulates durations (in ms): count, min, max, mean and a
+ * histogram with power-of-two buckets (0, 1, 2-3, 4-7, ..., 64+ ms). It is
+ * cheap enough to leave on all the time. nSysTime only ticks once per ms, so
+ * short sections mostly land in bucket 0; the mean is still meaningful
+ * (to a fraction of a ms) over many samples.
+ */
+#define TIMING_BUCKETS 8
+
+struct timing_t {
+	long started;       /* nSysTime at timingStart() */
+	int count;
+	int min;
+	int max;
+	long total;
+	int buckets[TIMING_BUCKETS];
+};
+
+void timingReset(timing_t* timing) {
+	timing->started = nSysTime;
+	timing->count = 0;
+	timing->min = 0;
+	timing->max = 0;
+	timing->total = 0;
+
+	for(int i=0;i<TIMING_BUCKETS;i++) {
+		timing->buckets[i] = 0;
+	}
+}
+
+void timingAdd(timing_t* timing, long ms) {
+	if(ms < 0) {
+		ms = 0;
+	}
+
+	if(timing->count == 0 || ms < timing->min) {
+		timing->min = ms;
+	}
+	if(ms > timing->max) {
+		timing->max = ms;
+	}
+
+	timing->count += 1;
+	timing->total += ms;
+
+	int bucket = 0;
+	while(ms > 0 && bucket < (TIMING_BUCKETS-1)) {
+		ms = ms >> 1;
+		bucket++;
+	}
+	timing->buckets[bucket] += 1;
+}
+
+void timingStart(timing_t* timing) {
+	timing->started = nSysTime;
+}
+
+void timingStop(timing_t* timing) {
+	timingAdd(timing, nSysTime - timing->started);
+}
+
+void timingReport(timing_t* timing, const char* name) {
+	if(timing->count == 0) {
+		writeDebugStreamLine("%s: no samples", name);
+		return;
+	}
+
+	long mean = (timing->total * 100) / timing->count; /* hundredths of a ms */
+	writeDebugStreamLine("%s: n %d, min %d, mean %d.%02d, max %d ms", name,
+		timing->count, timing->min, (int)(mean / 100), (int)(mean % 100), timing->max);
+
+	writeDebugStream("  ms");
+	for(int i=0;i<TIMING_BUCKETS;i++) {
+		if(i <= 1) {
+			writeDebugStream(" %d:%d", i, timing->buckets[i]);
+		} else if(i == (TIMING_BUCKETS-1)) {
+			writeDebugStream(" %d+:%d", 1 << (i-1), timing->buckets[i]);
+		} else {
+			writeDebugStream(" %d-%d:%d", 1 << (i-1), (1 << i) - 1, timing->buckets[i]);
+		}
+	}
+	writeDebugStreamLine("");
+}
+
+/*
+ * Periodic tick service.
+ *
+ * Tick n is due at (start + n*1000/hz) ms, computed from the start time
+ * every time, so loop cost and rounding never accumulate into drift: a loop
+ * that calls tickerWait() once per iteration runs exactly hz iterations per
+ * second on average. An iteration that runs past its deadline is counted as
+ * an overrun; the following ticks are then run back-to-back until the loop
+ * has caught up with the schedule.
+ *
+ * The ticker also times every iteration (from waking up to the next
+ * tickerWait() call) and how late it woke up relative to its deadline.
+ */
+struct ticker_t {
+	long start;         /* nSysTime at tick 0 */
+	int ticks;          /* ticks elapsed since start */
+	int hz;
+
+	int overruns;       /* number of ticks that were already late */
+	int maxLateness;    /* worst lateness seen, in ms */
+
+	long woke;          /* nSysTime when the current iteration started */
+	timing_t busy;      /* time spent per iteration */
+	timing_t jitter;    /* wake-up time past the deadline */
+};
+
+void tickerStart(ticker_t* ticker, int hz) {
+	ticker->start = nSysTime;
+	ticker->ticks = 0;
+	ticker->hz = hz;
+	ticker->overruns = 0;
+	ticker->maxLateness = 0;
+
+	ticker->woke = ticker->start;
+	timingReset(&ticker->busy);
+	timingReset(&ticker->jitter);
+}
+
+/* Milliseconds from tick 0 to tick n. */
+long tickerTimeAt(ticker_t* ticker, int n) {
+	return ((long)n * 1000) / ticker->hz;
+}
+
+/* Milliseconds from tick 0 to the current tick. */
+long tickerTime(ticker_t* ticker) {
+	return tickerTimeAt(ticker, ticker->ticks);
+}
+
+/* Sleep until the next tick is due. Returns false if it was already late. */
+bool tickerWait(ticker_t* ticker) {
+	ticker->ticks += 1;
+
+	long deadline = ticker->start + tickerTime(ticker);
+	long now = nSysTime;
+
+	timingAdd(&ticker->busy, now - ticker->woke);
+
+	if(now < deadline) {
+		sleep(deadline - now);
+		ticker->woke = nSysTime;
+		timingAdd(&ticker->jitter, ticker->woke - deadline);
+		return true;
+	}
+
+	ticker->woke = now;
+	timingAdd(&ticker->jitter, now - deadline);
+
+	ticker->overruns += 1;
+	if((now - deadline) > ticker->maxLateness) {
+		ticker->maxLateness = now - deadline;
+	}
+
+	return false;
+}
+
+void tickerReport(ticker_t* ticker) {
+	writeDebugStreamLine("Ticks: %d, overruns: %d, max late: %d ms", ticker->ticks, ticker->overruns, ticker->maxLateness);
+	timingReport(&ticker->busy, "Iteration");
+	timingReport(&ticker->jitter, "Wake-up lateness");
+}
+
+/*
+ * Per-stage timings, filled in by the robot programs around the calls they
+ * want to watch, and dumped with loopTimingReport().
+ */
+timing_t decodeTiming;   /* replay -> control state */
+timing_t controlTiming;  /* controlLoopIteration() */
+timing_t encodeTiming;   /* control state -> replay */
+timing_t lcdTiming;      /* one LCD refresh */
+
+void loopTimingReset() {
+	timingReset(&decodeTiming);
+	timingReset(&controlTiming);
+	timingReset(&encodeTiming);
+	timingReset(&lcdTiming);
+}
+
+void loopTimingReport(ticker_t* ticker) {
+	tickerReport(ticker);
+	timingReport(&decodeTiming, "Replay decode");
+	timingReport(&controlTiming, "Control");
+	timingReport(&encodeTiming, "Replay encode");
+	timingReport(&lcdTiming, "LCD");
+}
+
+/*
+ * Telemetry.
+ *
+ * Formatting text costs real time on the control task, so logging from the
+ * hot path goes into a ring of fixed-size binary records instead; a
+ * low-priority task (telemetryDrain) writes them to the debug stream as
+ * hex, one record per line:
+ *
+ *   T<id> <time> <a> <b> <c>       (time = nSysTime & 0xFFFF)
+ *
+ * Host/TelemetryDecode.c turns a captured debug stream back into tables.
+ * If the ring fills up, records are dropped and counted, and the count is
+ * printed as a TLM_DROPPED record once the drain catches up.
+ */
+#define TELEMETRY_CAPACITY 64
+
+/* Record ids and their fields. */
+#define TLM_DROPPED       0   /* a: records lost */
+#define TLM_FRAME         1   /* a, b, c: first three bytes of a replay frame */
+#define TLM_FILES_INDEXED 2   /* a: file count */
+#define TLM_FILE_FOUND    3   /* a, b, c: file name (see telemetryLogName) */
+#define TLM_FILE_MISSING  4   /* a, b, c: file name */
+#define TLM_CHUNK_MISSING 5   /* a: chunk number */
+#define TLM_CHUNK_FAILED  6   /* a: chunk number, b: RCFS error code */
+#define TLM_SAVING        7   /* a: frames, b: chunks, c: bytes in the header file */
+#define TLM_SAVE_FAILED   8   /* a: RCFS error code */
+#define TLM_SAVED         9
+#define TLM_READ_ONLY     10
+#define TLM_LOADED        11  /* a: frames, b: chunks, c: bytes in the header file */
+#define TLM_BAD_REPLAY    12  /* a: check that failed (REPLAY_BAD_*), b: value found */
+
+struct telemetry_t {
+	unsigned char id;
+	unsigned int time;
+	int a;
+	int b;
+	int c;
+};
+
+telemetry_t telemetry[TELEMETRY_CAPACITY];
+int telemetryHead = 0;      /* next record to fill */
+int telemetryTail = 0;      /* next record to print */
+int telemetryDropped = 0;
+
+void telemetryLog(int id, int a = 0, int b = 0, int c = 0) {
+	hogCPU();
+
+	int next = (telemetryHead + 1) % TELEMETRY_CAPACITY;
+	if(next == telemetryTail) {
+		telemetryDropped++;
+	} else {
+		telemetry_t* rec = &telemetry[telemetryHead];
+		rec->id = id;
+		rec->time = nSysTime & 0xFFFF;
+		rec->a = a;
+		rec->b = b;
+		rec->c = c;
+		telemetryHead = next;
+	}
+
+	releaseCPU();
+}
+
+/* Log the first six characters of `name`, two per field. */
+void telemetryLogName(int id, const char* name) {
+	int packed[3];
+	bool ended = false;
+
+	for(int i=0;i<6;i++) {
+		int ch = ended ? 0 : name[i];
+		if(ch == 0) {
+			ended = true;
+		}
+
+		if((i & 1) == 0) {
+			packed[i/2] = ch;
+		} else {
+			packed[i/2] |= ch << 8;
+		}
+	}
+
+	telemetryLog(id, packed[0], packed[1], packed[2]);
+}
+
+void telemetryPrint(int id, unsigned int time, int a, int b, int c) {
+	writeDebugStreamLine("T%02x %04x %04x %04x %04x", id, time, a & 0xFFFF, b & 0xFFFF, c & 0xFFFF);
+}
+
+/* Print every buffered record. Only the drain (or its owner, once it has stopped) calls this. */
+void telemetryFlush() {
+	while(telemetryTail != telemetryHead) {
+		telemetry_t* rec = &telemetry[telemetryTail];
+		telemetryPrint(rec->id, rec->time, rec->a, rec->b, rec->c);
+		telemetryTail = (telemetryTail + 1) % TELEMETRY_CAPACITY;
+	}
+
+	if(telemetryDropped > 0) {
+		hogCPU();
+		int dropped = telemetryDropped;
+		telemetryDropped = 0;
+		releaseCPU();
+
+		telemetryPrint(TLM_DROPPED, nSysTime & 0xFFFF, dropped, 0, 0);
+	}
+}
+
+task telemetryDrain() {
+	while(true) {
+		telemetryFlush();
+		sleep(20);
+	}
+}
+
+void startTelemetry() {
+	startTask(telemetryDrain, kLowPriority);
+}
+
+/* Stop the drain and print whatever is left. */
+void stopTelemetry() {
+	stopTask(telemetryDrain);
+	telemetryFlush();
+}
+
+/*
+ * LCD renderer.
+ *
+ * Tasks draw into a shadow copy of the 2x16 LCD with the lcdPut*()
+ * functions, then call lcdRefresh(), which sends only the characters that
+ * differ from what the LCD already shows. Each line is sent at most once
+ * every lcdRefreshPeriod ms however often it is called, so tasks drawing
+ * different lines don't hold back each other's. Only lines drawn through
+ * the renderer are managed; lcdInvalidate() forces a full redraw after
+ * something else has written to the LCD directly.
+ */
+#define LCD_WIDTH 16
+
+const int lcdRefreshPeriod = 100; // ms
+
+char lcdText[2][LCD_WIDTH];     /* what the LCD should show */
+char lcdShown[2][LCD_WIDTH];    /* what it shows */
+bool lcdLineUsed[2] = {false, false};
+bool lcdShownValid = false;
+long lcdLastRefresh[2] = {0, 0};
+
+void lcdInvalidate() {
+	lcdShownValid = false;
+}
+
+void lcdClear(int line) {
+	for(int i=0;i<LCD_WIDTH;i++) {
+		lcdText[line][i] = ' ';
+	}
+	lcdLineUsed[line] = true;
+}
+
+void lcdPutChar(int line, int pos, char c) {
+	if(pos >= 0 && pos < LCD_WIDTH) {
+		lcdText[line][pos] = c;
+	}
+	lcdLineUsed[line] = true;
+}
+
+void lcdPutString(int line, int pos, const char* str) {
+	for(int i=0; str[i] != 0; i++) {
+		lcdPutChar(line, pos+i, str[i]);
+	}
+}
+
+/*
+ * Right-aligned in `width` characters; a negative width pads with zeros
+ * instead of spaces (like displayLCDNumber). Wider numbers overflow to the
+ * right.
+ */
+void lcdPutNumber(int line, int pos, int value, int width) {
+	char pad = (width < 0) ? '0' : ' ';
+	width = abs(width);
+
+	bool negative = (value < 0);
+	int digits = 1;
+	for(int v = value / 10; v != 0; v = v / 10) {
+		digits++;
+	}
+
+	int len = digits + (negative ? 1 : 0);
+	if(len < width) {
+		for(int i=0;i<(width - len);i++) {
+			lcdPutChar(line, pos+i, pad);
+		}
+		pos += width - len;
+	}
+
+	if(negative) {
+		lcdPutChar(line, pos, '-');
+		pos++;
+	}
+
+	for(int i=digits-1;i>=0;i--) {
+		lcdPutChar(line, pos+i, '0' + abs(value % 10));
+		value = value / 10;
+	}
+}
+
+/*
+ * Tenths as a signed decimal ("-12.3"), right-aligned in `width`
+ * characters with the sign next to the digits.
+ */
+void lcdPutTenths(int line, int pos, int tenths, int width) {
+	int whole = abs(tenths) / 10;
+	int digits = 1;
+	for(int v = whole / 10; v != 0; v = v / 10) {
+		digits++;
+	}
+
+	int len = digits + 2 + ((tenths < 0) ? 1 : 0);
+	for(int i=len;i<width;i++) {
+		lcdPutChar(line, pos, ' ');
+		pos++;
+	}
+
+	if(tenths < 0) {
+		lcdPutChar(line, pos, '-');
+		pos++;
+	}
+	lcdPutNumber(line, pos, whole, digits);
+	lcdPutChar(line, pos+digits, '.');
+	lcdPutNumber(line, pos+digits+1, abs(tenths) % 10, 1);
+}
+
+/* Milliseconds as "ss.mmm" (6 characters). */
+void lcdPutTime(int line, int pos, long ms) {
+	lcdPutNumber(line, pos, ms / 1000, 2);
+	lcdPutChar(line, pos+2, '.');
+	lcdPutNumber(line, pos+3, ms % 1000, -3);
+}
+
+bool lcdLineChanged(int line) {
+	for(int i=0;i<LCD_WIDTH;i++) {
+		if(lcdShown[line][i] != lcdText[line][i]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Send what changed. A changed line that was sent less than lcdRefreshPeriod
+ * ms ago stays pending until a later call; returns false if any did.
+ */
+bool lcdRefresh() {
+	bool sent = true;
+
+	for(int line=0;line<2;line++) {
+		if(!lcdLineUsed[line] || (lcdShownValid && !lcdLineChanged(line))) {
+			continue;
+		}
+
+		if(lcdShownValid && (nSysTime - lcdLastRefresh[line]) < lcdRefreshPeriod) {
+			sent = false;
+			continue;
+		}
+		lcdLastRefresh[line] = nSysTime;
+
+		for(int i=0;i<LCD_WIDTH;i++) {
+			if(!lcdShownValid || lcdShown[line][i] != lcdText[line][i]) {
+				displayLCDChar(line, i, lcdText[line][i]);
+				lcdShown[line][i] = lcdText[line][i];
+			}
+		}
+	}
+
+	lcdShownValid = true;
+	return sent;
+}
+
+#define REPLAY_HEADER_SIZE 16    /* see the on-flash format below */
+#define REPLAY_MAGIC_0 'R'
+#define REPLAY_MAGIC_1 'P'
+#define REPLAY_VERSION 2          /* 1: no keyframe index */
+#define REPLAY_FRAME_SIZE 3      /* bytes per frame written by the robot backend */
+#define REPLAY_MAX_FRAME_SIZE 6  /* limited by the 6-bit change mask */
+
+#define REPLAY_CHUNK_SIZE 2048   /* stream bytes per chunk file */
+#define REPLAY_MAX_CHUNKS 8      /* 61 s at 30 Hz with room to spare (see Host/DriveCheck.c) */
+#define REPLAY_HALF_SIZE (REPLAY_HEADER_SIZE + REPLAY_CHUNK_SIZE)
+#define REPLAY_MAX_KEYFRAMES 64
+#define REPLAY_KEYFRAME_SIZE 6   /* index entry: offset, frame, backend state */
+#define REPLAY_KEY_STATE_SIZE 2
+#define REPLAY_INDEX_SIZE (REPLAY_MAX_KEYFRAMES * REPLAY_KEYFRAME_SIZE)
+#define REPLAY_BUFFER_SIZE ((2 * REPLAY_HALF_SIZE) + REPLAY_INDEX_SIZE) /* RAM needed to record */
+
+#define REPLAY_RATE_NORMAL 100   /* playback speed, percent */
+
+/* Frame layouts, so that a replay is only played by the robot that made it. */
+#define REPLAY_LAYOUT_ANY       0  /* not checked */
+#define REPLAY_LAYOUT_AKAGI     1  /* 3631A */
+#define REPLAY_LAYOUT_WARSPITE  2  /* 3631 */
+#define REPLAY_LAYOUT_SHIMAKAZE 3  /* Testing */
+
+/* Reasons a replay file is rejected (logged with TLM_BAD_REPLAY). */
+#define REPLAY_BAD_MAGIC      1
+#define REPLAY_BAD_VERSION    2
+#define REPLAY_BAD_LAYOUT     3
+#define REPLAY_BAD_RATE       4
+#define REPLAY_BAD_FRAME_SIZE 5
+#define REPLAY_BAD_CHUNKS     6
+#define REPLAY_BAD_SIZE       7
+#define REPLAY_BAD_CRC        8
+#define REPLAY_BAD_INDEX      9
+
+/* CRC-16/CCITT (polynomial 0x1021), a nibble at a time. */
+const unsigned int replayCrcTable[16] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+#define REPLAY_CRC_INIT 0xFFFF
+
+unsigned int replayCrcByte(unsigned int crc, unsigned char dat) {
+	crc = ((crc << 4) ^ replayCrcTable[((crc >> 12) ^ (dat >> 4)) & 0x0F]) & 0xFFFF;
+	crc = ((crc << 4) ^ replayCrcTable[((crc >> 12) ^ dat) & 0x0F]) & 0xFFFF;
+	return crc;
+}
+
+unsigned int replayCrc(unsigned int crc, unsigned char* dat, unsigned int len) {
+	for(unsigned int i=0;i<len;i++) {
+		crc = replayCrcByte(crc, dat[i]);
+	}
+	return crc;
+}
+
+/*
+ * A replay is read straight out of the memory-mapped flash files it was
+ * loaded from, so programs that only play replays need no stream buffer.
+ *
+ * Programs that record supply a buffer through initReplayBuffer(). It is
+ * split in two halves: while one fills up, the other (once full) is written
+ * out to flash as a chunk file by the replayWriter task, so a recording is
+ * not limited by how much RAM is free. The writer waits until the active
+ * half is part full (see replayChunkDue()), so a full half may still be in
+ * RAM when recording stops; saveReplayToFile() writes it out. Whatever is in
+ * the active half goes into the replay's own file.
+ */
+struct replay_t {
+	unsigned char* streamData;    /* segment being read / written */
+	unsigned int streamCapacity;  /* bytes writable at streamData (0 = read-only) */
+	unsigned int streamIndex;     /* position in the segment */
+	unsigned int streamSize;      /* end of the segment's data */
+	bool loaded;
+
+	/* Recording. */
+	unsigned char* buffer;        /* both halves */
+	int activeHalf;
+	bool flushPending;            /* the other half is full and not yet in flash */
+	bool overflowed;              /* stream was cut short; recording should stop */
+
+	/* Segments: chunk files 0..nChunks-1, then the replay file itself. */
+	unsigned char* chunkData[REPLAY_MAX_CHUNKS];
+	unsigned char* headData;
+	unsigned int headSize;
+	int nChunks;
+	int segment;
+	unsigned int tag;             /* ties chunk files to their replay file */
+	int layout;                   /* REPLAY_LAYOUT_* */
+	unsigned int crc;             /* over the stream, then the header (see below) */
+
+	/* Frame codec state (see the format description below). */
+	unsigned char frame[REPLAY_MAX_FRAME_SIZE];     /* frame being read / written */
+	unsigned char lastFrame[REPLAY_MAX_FRAME_SIZE]; /* last frame written to the stream */
+	int frameSize;
+	int framePos;
+	int runLength;              /* repeats pending (write) or remaining (read) */
+	unsigned int frameCount;    /* frames in the stream */
+	unsigned int framesRead;
+
+	/* Frame rate, playback speed and tick rate (see replayFramesDue()). */
+	int frameHz;                /* frames recorded per second */
+	int rate;                   /* percent of the recording's speed */
+	int tickHz;                 /* playback ticks per second */
+	unsigned long ratePos;      /* position of the next tick */
+	unsigned long tickPos;      /* position of the current tick */
+
+	/* Keyframe index (see seekReplay()). */
+	unsigned char* keyIndex;    /* REPLAY_KEYFRAME_SIZE bytes per keyframe */
+	int nKeyframes;
+	int keyInterval;            /* frames between keyframes while recording (0 = none) */
+	unsigned char keyState[REPLAY_KEY_STATE_SIZE];  /* backend state at the keyframe */
+};
+
+void resetReplayCodec(replay_t* data) {
+	memset(data->frame, 0, REPLAY_MAX_FRAME_SIZE);
+	memset(data->lastFrame, 0, REPLAY_MAX_FRAME_SIZE);
+	data->framePos = 0;
+	data->runLength = 0;
+	data->framesRead = 0;
+	data->ratePos = 0;
+	data->tickPos = 0;
+}
+
+void initReplayData(replay_t* data) {
+	data->streamData = NULL;
+	data->streamCapacity = 0;
+	data->streamIndex = REPLAY_HEADER_SIZE;
+	data->streamSize = 0;
+	data->loaded = false;
+
+	data->buffer = NULL;
+	data->activeHalf = 0;
+	data->flushPending = false;
+	data->overflowed = false;
+
+	data->headData = NULL;
+	data->headSize = 0;
+	data->nChunks = 0;
+	data->segment = 0;
+	data->tag = 0;
+	data->layout = REPLAY_LAYOUT_ANY;
+	data->crc = REPLAY_CRC_INIT;
+
+	data->frameSize = REPLAY_FRAME_SIZE;
+	data->frameCount = 0;
+	data->frameHz = (int)snapshotFreq;
+	data->rate = REPLAY_RATE_NORMAL;
+	data->tickHz = (int)snapshotFreq;
+
+	data->keyIndex = NULL;
+	data->nKeyframes = 0;
+	data->keyInterval = 0;
+	memset(data->keyState, 0, REPLAY_KEY_STATE_SIZE);
+	resetReplayCodec(data);
+}
+
+/* `buffer` must hold REPLAY_BUFFER_SIZE bytes; frameSize and layout are fixed for the whole replay. */
+void initReplayBuffer(replay_t* data, unsigned char* buffer, int frameSize = REPLAY_FRAME_SIZE, int layout = REPLAY_LAYOUT_ANY) {
+	initReplayData(data);
+	data->frameSize = frameSize;
+	data->layout = layout;
+	data->buffer = buffer;
+	data->streamData = buffer;
+	data->streamCapacity = REPLAY_HALF_SIZE;
+	data->keyIndex = buffer + (2 * REPLAY_HALF_SIZE);
+	data->tag = nSysTime & 0xFFFF;
+}
+
+bool replayOverflowed(replay_t* data) {
+	return data->overflowed;
+}
+
+/* Point the read cursor at the start of segment n. */
+void selectReplaySegment(replay_t* data, int n) {
+	data->segment = n;
+	if(n < data->nChunks) {
+		data->streamData = data->chunkData[n] + 2; // skip tag
+		data->streamIndex = 0;
+		data->streamSize = REPLAY_CHUNK_SIZE;
+	} else {
+		data->streamData = data->headData;
+		data->streamIndex = REPLAY_HEADER_SIZE;
+		data->streamSize = data->headSize - (data->nKeyframes * REPLAY_KEYFRAME_SIZE);
+	}
+}
+
+void rewindReplay(replay_t* data) {
+	selectReplaySegment(data, 0);
+	resetReplayCodec(data);
+}
+
+/*
+ * Hand the full half over to the replayWriter task and carry on in the
+ * other one. Fails (and flags the replay as overflowed) if the other half
+ * hasn't been written out yet, or there's no room for another chunk.
+ */
+bool swapReplayHalf(replay_t* data) {
+	if(data->buffer == NULL || data->overflowed) {
+		return false;
+	}
+
+	if(data->flushPending || data->nChunks >= REPLAY_MAX_CHUNKS) {
+		data->overflowed = true;
+		return false;
+	}
+
+	/* Chunk files are the tag followed by the stream bytes. */
+	data->streamData[REPLAY_HEADER_SIZE-2] = (data->tag & 0xFF);
+	data->streamData[REPLAY_HEADER_SIZE-1] = ((data->tag & 0xFF00) >> 8) & 0xFF;
+	data->nChunks += 1;
+	data->flushPending = true;
+
+	data->activeHalf = 1 - data->activeHalf;
+	data->streamData = data->buffer + (data->activeHalf * REPLAY_HALF_SIZE);
+	data->streamIndex = REPLAY_HEADER_SIZE;
+	return true;
+}
+
+/*
+ * Frame encoding:
+ *
+ * The robot backend reads and writes fixed-size frames a byte at a time with
+ * readNextByte() / writeByte(), one frame per tick of its loop; Enterprise
+ * compresses whole frames as they are completed. The stream that comes out
+ * is a list of input events: a run token says for how many ticks nothing
+ * changed, and a change token carries only the bytes that did. Each encoded
+ * frame starts with a token byte:
+ *
+ *  1nnnnnnn          -> the previous frame repeats n+1 times (run-length)
+ *  01mmmmmm d...     -> bytes selected by mask m changed by small amounts;
+ *                       d holds one signed 4-bit delta per changed byte,
+ *                       two per byte, low nibble first
+ *  00mmmmmm b...     -> bytes selected by mask m changed; b holds their new
+ *                       values verbatim
+ *
+ * Bit i of the mask refers to byte i of the frame. The frame before the first
+ * one is all zeroes. A frame that is held (e.g. the driver is idle) costs one
+ * byte per 128 frames, and a button byte is only stored when it changes.
+ *
+ * Since held frames cost next to nothing, a recorder can tick faster than
+ * snapshotFreq (see setReplayFrameRate()) to time its inputs more finely:
+ * the stream grows with the number of changes, not with the frame rate.
+ * Sensor deltas (see the Akagi backend) change on most ticks while the
+ * robot moves, so those do cost more at a higher rate.
+ *
+ * Keyframes (see seekReplay()) are frames written whole, with a 00 token
+ * and every bit of the mask set, whatever changed: decoding can start at
+ * one without knowing the frames before it.
+ */
+
+unsigned char readStreamByte(replay_t* data) {
+	if(data->streamIndex >= data->streamSize && data->segment < data->nChunks) {
+		selectReplaySegment(data, data->segment + 1);
+	}
+
+	unsigned char ret = data->streamData[data->streamIndex];
+	data->streamIndex += 1;
+	return ret;
+}
+
+void writeStreamByte(replay_t* data, unsigned char dat) {
+	if(data->streamIndex >= data->streamCapacity && !swapReplayHalf(data)) {
+		return;
+	}
+
+	data->streamData[data->streamIndex] = dat;
+	data->streamIndex += 1;
+	data->crc = replayCrcByte(data->crc, dat);
+}
+
+void decodeFrame(replay_t* data) {
+	data->framesRead += 1;
+
+	if(data->runLength > 0) {
+		data->runLength -= 1;
+		return;
+	}
+
+	unsigned char token = readStreamByte(data);
+	if(token & 0x80) {
+		data->runLength = (token & 0x7F);
+		return;
+	}
+
+	unsigned char mask = token & 0x3F;
+	if(token & 0x40) {
+		int n = 0;
+		unsigned char packed = 0;
+		for(int i=0;i<data->frameSize;i++) {
+			if(TEST_BIT(mask, i)) {
+				if((n & 1) == 0) {
+					packed = readStreamByte(data);
+				}
+				int delta = ((n & 1) ? (packed >> 4) : packed) & 0x0F;
+				if(delta > 7) {
+					delta -= 16;
+				}
+				data->frame[i] = (unsigned char)(data->frame[i] + delta);
+				n++;
+			}
+		}
+	} else {
+		for(int i=0;i<data->frameSize;i++) {
+			if(TEST_BIT(mask, i)) {
+				data->frame[i] = readStreamByte(data);
+			}
+		}
+	}
+}
+
+/* Stream bytes written so far, across chunks. */
+unsigned int replayStreamOffset(replay_t* data) {
+	return (data->nChunks * REPLAY_CHUNK_SIZE) + (data->streamIndex - REPLAY_HEADER_SIZE);
+}
+
+/*
+ * Note a keyframe at the current stream position. When the index is full,
+ * every other keyframe is dropped and they are made half as often, so the
+ * index stays sparse but covers the whole replay.
+ */
+void addKeyframe(replay_t* data, unsigned int frame) {
+	if(data->nKeyframes == REPLAY_MAX_KEYFRAMES) {
+		for(int i=1;i<REPLAY_MAX_KEYFRAMES/2;i++) {
+			memcpy(data->keyIndex + (i * REPLAY_KEYFRAME_SIZE), data->keyIndex + (2 * i * REPLAY_KEYFRAME_SIZE), REPLAY_KEYFRAME_SIZE);
+		}
+		data->nKeyframes = REPLAY_MAX_KEYFRAMES/2;
+		data->keyInterval *= 2;
+	}
+
+	unsigned int offset = replayStreamOffset(data);
+	unsigned char* key = data->keyIndex + (data->nKeyframes * REPLAY_KEYFRAME_SIZE);
+	key[0] = (offset & 0xFF);
+	key[1] = ((offset & 0xFF00) >> 8) & 0xFF;
+	key[2] = (frame & 0xFF);
+	key[3] = ((frame & 0xFF00) >> 8) & 0xFF;
+	memcpy(key + 4, data->keyState, REPLAY_KEY_STATE_SIZE);
+	data->nKeyframes += 1;
+}
+
+void flushReplayRun(replay_t* data) {
+	while(data->runLength > 0) {
+		int n = (data->runLength > 128) ? 128 : data->runLength;
+		writeStreamByte(data, 0x80 | (n - 1));
+		data->runLength -= n;
+	}
+}
+
+/*
+ * Whether a frame can still be encoded without being cut short. Counts the
+ * worst case, including the run tokens still to be written, so that the
+ * stream can always be finished off cleanly.
+ */
+bool replayHasRoom(replay_t* data) {
+	if(data->overflowed || data->frameCount >= 0xFFFF) {
+		return false;
+	}
+
+	unsigned int worst = ((data->runLength + 128) / 128) + 1 + data->frameSize;
+	if((data->streamCapacity - data->streamIndex) >= worst) {
+		return true;
+	}
+
+	return (data->buffer != NULL) && !data->flushPending && (data->nChunks < REPLAY_MAX_CHUNKS);
+}
+
+void encodeFrame(replay_t* data) {
+	if(!replayHasRoom(data)) {
+		data->overflowed = true;
+		return;
+	}
+
+	bool key = (data->keyInterval > 0) && ((data->frameCount % data->keyInterval) == 0);
+	data->frameCount += 1;
+
+	unsigned char mask = 0;
+	bool small = true;
+	int nChanged = 0;
+	for(int i=0;i<data->frameSize;i++) {
+		if(data->frame[i] != data->lastFrame[i]) {
+			signed char delta = (signed char)(data->frame[i] - data->lastFrame[i]);
+			mask |= (1 << i);
+			small = small && (delta >= -8) && (delta <= 7);
+			nChanged++;
+		}
+	}
+
+	if(mask == 0 && !key) {
+		data->runLength += 1;
+		return;
+	}
+
+	flushReplayRun(data);
+
+	if(key) {
+		addKeyframe(data, data->frameCount - 1);
+		mask = (1 << data->frameSize) - 1;
+	}
+
+	/* Nibble deltas only pay off when they save at least a byte. */
+	if(!key && small && nChanged > 1) {
+		writeStreamByte(data, 0x40 | mask);
+
+		int n = 0;
+		unsigned char packed = 0;
+		for(int i=0;i<data->frameSize;i++) {
+			if(TEST_BIT(mask, i)) {
+				unsigned char delta = (unsigned char)(data->frame[i] - data->lastFrame[i]) & 0x0F;
+				if((n & 1) == 0) {
+					packed = delta;
+				} else {
+					writeStreamByte(data, packed | (delta << 4));
+				}
+				n++;
+			}
+		}
+		if(n & 1) {
+			writeStreamByte(data, packed);
+		}
+	} else {
+		writeStreamByte(data, mask);
+		for(int i=0;i<data->frameSize;i++) {
+			if(TEST_BIT(mask, i)) {
+				writeStreamByte(data, data->frame[i]);
+			}
+		}
+	}
+
+	memcpy(data->lastFrame, data->frame, data->frameSize);
+}
+
+unsigned char readNextByte(replay_t* data) {
+	if(data->framePos == 0) {
+		decodeFrame(data);
+	}
+
+	unsigned char ret = data->frame[data->framePos];
+	data->framePos = (data->framePos + 1) % data->frameSize;
+	return ret;
+}
+
+void writeByte(replay_t* data, unsigned char dat) {
+	data->frame[data->framePos] = dat;
+	data->framePos += 1;
+
+	if(data->framePos == data->frameSize) {
+		encodeFrame(data);
+		data->framePos = 0;
+	}
+}
+
+/*
+ * Whole frames at once, for code that has them packed already: a copy
+ * instead of a call per byte. Not to be mixed with readNextByte() /
+ * writeByte() in the middle of a frame.
+ */
+void readReplayFrame(replay_t* data, unsigned char* out) {
+	decodeFrame(data);
+	memcpy(out, data->frame, data->frameSize);
+}
 
-const float snapshotFreq = 30; // Hz
-const float deltaT = (1/snapshotFreq) * 1000; // time between snapshots in milliseconds
+void writeReplayFrame(replay_t* data, unsigned char* in) {
+	memcpy(data->frame, in, data->frameSize);
+	encodeFrame(data);
+}
 
-#define TEST_BIT(x, i) (((x)&(1<<(i))) > 0)
+/*
+ * Control maps.
+ *
+ * Each robot backend lists the controls it records once, in a control_map_t
+ * bound to its control_t (bindControls() in the backend), and packs and
+ * unpacks frames through it. The layout follows from the list: a byte per
+ * axis in the order they were added, then the buttons, eight to a byte,
+ * bit 0 first. Anything after that (e.g. sensor deltas) is up to the
+ * backend.
+ *
+ * ROBOTC has no function pointers or offsetof(), so the map holds the
+ * addresses of the fields of one control_t; bind it again for another.
+ * Each control is also named; the host tools (Host/ReplayLib.h) label
+ * frames from a bound map, and only host builds keep the names.
+ */
+#define CONTROL_MAX_AXES 4
+#define CONTROL_MAX_BUTTONS 16
 
-struct replay_t {
-	unsigned char streamData[10802];
-	unsigned int streamIndex;
-	unsigned int streamSize;
-	bool loaded;
+/* How live input is layered over a replay's, per axis (see mergeControls()). */
+#define CONTROL_MERGE_OVERRIDE 0  /* live input replaces the replay's when outside the deadband */
+#define CONTROL_MERGE_ADD      1  /* live input is added to the replay's */
+
+struct control_map_t {
+	signed char* axes[CONTROL_MAX_AXES];
+	signed char* recordedAxes[CONTROL_MAX_AXES];  /* what gets written */
+	int axisMerge[CONTROL_MAX_AXES];              /* CONTROL_MERGE_* */
+	bool* buttons[CONTROL_MAX_BUTTONS];
+	int nAxes;
+	int nButtons;
+	int size;  /* frame bytes taken by the controls */
+#ifdef ROBOTC_HOST
+	const char* axisNames[CONTROL_MAX_AXES];
+	const char* buttonNames[CONTROL_MAX_BUTTONS];
+#endif
 };
 
-void initReplayData(replay_t* data) {
-	data->streamIndex = 2;
-	data->streamSize = 0;
-	data->loaded = false;
+void initControlMap(control_map_t* map) {
+	map->nAxes = 0;
+	map->nButtons = 0;
+	map->size = 0;
 }
 
-unsigned char readNextByte(replay_t* data) {
-	unsigned char ret = data->streamData[data->streamIndex];
-	data->streamIndex += 1;
-	return ret;
+/* `recorded`, if given, is written in place of `axis` (e.g. a filtered copy). */
+void mapAxis(control_map_t* map, const char* name, signed char* axis, signed char* recorded = NULL, int merge = CONTROL_MERGE_OVERRIDE) {
+	if(map->nAxes >= CONTROL_MAX_AXES || map->nButtons > 0) {
+		return; // axes come first
+	}
+
+#ifdef ROBOTC_HOST
+	map->axisNames[map->nAxes] = name;
+#endif
+	map->axes[map->nAxes] = axis;
+	map->recordedAxes[map->nAxes] = (recorded != NULL) ? recorded : axis;
+	map->axisMerge[map->nAxes] = merge;
+	map->nAxes += 1;
+	map->size += 1;
 }
 
-void writeByte(replay_t* data, unsigned char dat) {
-	data->streamData[data->streamIndex] = dat;
-	data->streamIndex += 1;
+void mapButton(control_map_t* map, const char* name, bool* button) {
+	if(map->nButtons >= CONTROL_MAX_BUTTONS) {
+		return;
+	}
+
+#ifdef ROBOTC_HOST
+	map->buttonNames[map->nButtons] = name;
+#endif
+	map->buttons[map->nButtons] = button;
+	map->nButtons += 1;
+	map->size = map->nAxes + ((map->nButtons + 7) / 8);
 }
 
-void findFile(char* name, flash_file* out) {
-		flash_file cur;
+void packControls(control_map_t* map, unsigned char* frame) {
+	for(int i=0;i<map->nAxes;i++) {
+		frame[i] = (unsigned char)(*map->recordedAxes[i]);
+	}
 
-    RCFS_FileInit(&cur);
-    RCFS_FileInit(out);
+	memset(frame + map->nAxes, 0, map->size - map->nAxes);
+	for(int i=0;i<map->nButtons;i++) {
+		if(*map->buttons[i]) {
+			frame[map->nAxes + (i >> 3)] |= (1 << (i & 7));
+		}
+	}
+}
+
+void unpackControls(control_map_t* map, unsigned char* frame) {
+	for(int i=0;i<map->nAxes;i++) {
+		*map->axes[i] = (signed char)frame[i];
+	}
+
+	for(int i=0;i<map->nButtons;i++) {
+		*map->buttons[i] = TEST_BIT(frame[map->nAxes + (i >> 3)], i & 7);
+	}
+}
+
+/* OR the buttons of `frame` into `into`, so that a press in either counts. */
+void mergeButtons(control_map_t* map, unsigned char* into, unsigned char* frame) {
+	for(int i=map->nAxes;i<map->size;i++) {
+		into[i] |= frame[i];
+	}
+}
+
+/*
+ * Layer the live controls bound to `live` over a replay's, bound to `base`
+ * (the same controls, of another control_t), for overdubbing: each axis as
+ * its map says, with live input inside `deadband` counting as none, and
+ * buttons pressed in either. The result is left in `live`'s fields.
+ */
+void mergeControls(control_map_t* live, control_map_t* base, int deadband) {
+	for(int i=0;i<live->nAxes;i++) {
+		int value = *live->axes[i];
+		if(abs(value) < deadband) {
+			value = 0;
+		}
+
+		if(live->axisMerge[i] == CONTROL_MERGE_ADD) {
+			value += *base->axes[i];
+		} else if(value == 0) {
+			value = *base->axes[i];
+		}
+		*live->axes[i] = (value > 127) ? 127 : ((value < -127) ? -127 : value);
+	}
+
+	for(int i=0;i<live->nButtons;i++) {
+		*live->buttons[i] = *live->buttons[i] || *base->buttons[i];
+	}
+}
+
+/* For backends that record nothing but their controls. */
+void controlsToReplay(control_map_t* map, replay_t* replay) {
+	unsigned char frame[REPLAY_MAX_FRAME_SIZE];
+	memset(frame, 0, REPLAY_MAX_FRAME_SIZE);
+	packControls(map, frame);
+	writeReplayFrame(replay, frame);
+}
+
+void replayToControls(control_map_t* map, replay_t* replay) {
+	unsigned char frame[REPLAY_MAX_FRAME_SIZE];
+	memset(frame, 0, REPLAY_MAX_FRAME_SIZE);
+	readReplayFrame(replay, frame);
+	unpackControls(map, frame);
+}
+
+/* True once every recorded frame has been read back. */
+bool replayFinished(replay_t* data) {
+	return data->framesRead >= data->frameCount;
+}
+
+/*
+ * Frames per second to record at, snapshotFreq unless set; call before
+ * the first frame is written. Stored in the header and played back at.
+ */
+void setReplayFrameRate(replay_t* data, int hz) {
+	data->frameHz = (hz < 1) ? 1 : ((hz > 255) ? 255 : hz);
+}
+
+/*
+ * Playback speed and tick rate. Playback ticks `hz` times a second (by
+ * default snapshotFreq), and each tick plays back however many frames are
+ * due at `percent` of the recording's speed: none on most ticks when
+ * ticking faster than frames were recorded, several now and then when
+ * playing faster than 100% or ticking slower than frames were recorded.
+ *
+ * Positions count in units of 1 / (REPLAY_RATE_NORMAL * tickHz) frames.
+ */
+void setReplayRate(replay_t* data, int percent) {
+	data->rate = (percent < 1) ? 1 : percent;
+}
+
+void setReplayTickRate(replay_t* data, int hz) {
+	data->tickHz = (hz < 1) ? 1 : hz;
+}
+
+/* Frames to read this tick; call once per tick. */
+int replayFramesDue(replay_t* data) {
+	unsigned long unit = REPLAY_RATE_NORMAL * data->tickHz;
+	unsigned int due = (data->ratePos / unit) + 1;
+	if(due > data->frameCount) {
+		due = data->frameCount;
+	}
+
+	data->tickPos = data->ratePos;
+	data->ratePos += data->rate * data->frameHz;
+	return (due > data->framesRead) ? (due - data->framesRead) : 0;
+}
+
+/* True once the last frame has been played back for as long as it was recorded. */
+bool replayPlayedBack(replay_t* data) {
+	return replayFinished(data) && (data->ratePos / (REPLAY_RATE_NORMAL * data->tickHz)) >= data->frameCount;
+}
+
+#define REPLAY_PHASE_ONE 256
+
+/* How far the current tick is into the last frame read, 0..REPLAY_PHASE_ONE-1. */
+int replayFramePhase(replay_t* data) {
+	unsigned long unit = REPLAY_RATE_NORMAL * data->tickHz;
+	return ((data->tickPos % unit) * REPLAY_PHASE_ONE) / unit;
+}
+
+/*
+ * Decode the frame after the last one read into `out`, without moving on
+ * (for interpolating towards it). At the end, that's the last frame again.
+ */
+void peekReplayFrame(replay_t* data, unsigned char* out) {
+	if(replayFinished(data)) {
+		memcpy(out, data->frame, data->frameSize);
+		return;
+	}
+
+	replay_t probe;
+	memcpy(&probe, data, sizeof(replay_t));
+	decodeFrame(&probe);
+	memcpy(out, probe.frame, probe.frameSize);
+}
+
+/*
+ * Seeking.
+ *
+ * A recorder that calls setReplayKeyframeInterval() gets a keyframe every
+ * `frames` frames (fewer in long replays, see addKeyframe()), each listed
+ * in an index saved after the stream: where it starts in the stream, its
+ * frame number, and REPLAY_KEY_STATE_SIZE bytes of backend state (the
+ * backend keeps keyState up to date before each frame it writes). Playback
+ * can then start at any keyframe, with the backend state it had there.
+ */
+void setReplayKeyframeInterval(replay_t* data, int frames) {
+	data->keyInterval = (frames < 0) ? 0 : frames;
+}
+
+unsigned int keyframeOffset(replay_t* data, int n) {
+	unsigned char* key = data->keyIndex + (n * REPLAY_KEYFRAME_SIZE);
+	return key[0] | (((unsigned int)key[1]) << 8);
+}
+
+unsigned int keyframeFrame(replay_t* data, int n) {
+	unsigned char* key = data->keyIndex + (n * REPLAY_KEYFRAME_SIZE);
+	return key[2] | (((unsigned int)key[3]) << 8);
+}
+
+/*
+ * Move a loaded replay to the last keyframe at or before `frame` (a binary
+ * search of the index), so that it plays from there at the next tick, and
+ * put the backend state recorded with it in keyState. Returns the frame it
+ * moved to: 0, with keyState cleared, if there is no such keyframe.
+ */
+unsigned int seekReplay(replay_t* data, unsigned int frame) {
+	rewindReplay(data);
+	memset(data->keyState, 0, REPLAY_KEY_STATE_SIZE);
+
+	int found = -1;
+	int lo = 0, hi = data->nKeyframes - 1;
+	while(lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if(keyframeFrame(data, mid) <= frame) {
+			found = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	if(found < 0) {
+		return 0;
+	}
+
+	unsigned int offset = keyframeOffset(data, found);
+	int segment = offset / REPLAY_CHUNK_SIZE;
+	if(segment > data->nChunks) {
+		segment = data->nChunks;
+	}
+	selectReplaySegment(data, segment);
+	data->streamIndex += offset - (segment * REPLAY_CHUNK_SIZE);
+
+	unsigned int at = keyframeFrame(data, found);
+	data->framesRead = at;
+	data->ratePos = (unsigned long)at * REPLAY_RATE_NORMAL * data->tickHz;
+	memcpy(data->keyState, data->keyIndex + (found * REPLAY_KEYFRAME_SIZE) + 4, REPLAY_KEY_STATE_SIZE);
+	return at;
+}
+
+/* Whether keyframe n is in order and starts with a whole frame. */
+bool keyframeValid(replay_t* data, int n) {
+	unsigned int offset = keyframeOffset(data, n);
+	unsigned int total = (data->nChunks * REPLAY_CHUNK_SIZE) + (data->headSize - REPLAY_HEADER_SIZE - (data->nKeyframes * REPLAY_KEYFRAME_SIZE));
+	if(offset >= total || keyframeFrame(data, n) >= data->frameCount) {
+		return false;
+	}
+	if(n > 0 && (offset <= keyframeOffset(data, n-1) || keyframeFrame(data, n) <= keyframeFrame(data, n-1))) {
+		return false;
+	}
+
+	int segment = offset / REPLAY_CHUNK_SIZE;
+	unsigned char token;
+	if(segment < data->nChunks) {
+		token = data->chunkData[segment][2 + (offset % REPLAY_CHUNK_SIZE)];
+	} else {
+		token = data->headData[REPLAY_HEADER_SIZE + offset - (data->nChunks * REPLAY_CHUNK_SIZE)];
+	}
+	return token == ((1 << data->frameSize) - 1);
+}
+
+/*
+ * Check a loaded replay's CRC, then decode it without playing it, to check
+ * that the stream holds exactly as many frames as its header says, and
+ * that the keyframe index points at keyframes.
+ */
+bool validateReplay(replay_t* data) {
+	if(data->headSize < REPLAY_HEADER_SIZE) {
+		return false;
+	}
+
+	if(data->headData != NULL) {
+		unsigned int crc = REPLAY_CRC_INIT;
+		for(int i=0;i<data->nChunks;i++) {
+			crc = replayCrc(crc, data->chunkData[i] + 2, REPLAY_CHUNK_SIZE);
+		}
+		crc = replayCrc(crc, data->headData + REPLAY_HEADER_SIZE, data->headSize - REPLAY_HEADER_SIZE);
+		crc = replayCrc(crc, data->headData, REPLAY_HEADER_SIZE - 2);
+		if(crc != data->crc) {
+#ifdef DEBUG
+			telemetryLog(TLM_BAD_REPLAY, REPLAY_BAD_CRC, crc);
+#endif
+			return false;
+		}
+	}
+
+	replay_t probe;
+	memcpy(&probe, data, sizeof(replay_t));
+	rewindReplay(&probe);
+
+	while(!replayFinished(&probe)) {
+		for(int i=0;i<probe.frameSize;i++) {
+			readNextByte(&probe);
+		}
+
+		if(probe.streamIndex > probe.streamSize) {
+			return false;
+		}
+	}
+
+	if(probe.segment != probe.nChunks || probe.streamIndex != probe.streamSize) {
+		return false;
+	}
+
+	for(int i=0;i<data->nKeyframes;i++) {
+		if(!keyframeValid(data, i)) {
+#ifdef DEBUG
+			telemetryLog(TLM_BAD_REPLAY, REPLAY_BAD_INDEX, i);
+#endif
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * File index.
+ *
+ * RCFS never overwrites a file: saving under an existing name appends a new
+ * copy to the VTOC, and the newest copy is the one that counts. Rather than
+ * walking the whole VTOC on every lookup, the newest copy of each name is
+ * kept in a small hash table, built with one pass over the VTOC (ideally in
+ * pre_auton) and updated in place whenever a file is saved.
+ */
+#define FILE_INDEX_SIZE 32 /* must be a power of two */
+
+flash_file fileIndex[FILE_INDEX_SIZE];
+flash_file fileIndexTail;   /* last VTOC entry seen, to pick up new files from */
+bool fileIndexBuilt = false;
+bool fileIndexFull = false; /* some names didn't fit; fall back to VTOC scans */
+
+unsigned int hashFileName(const char* name) {
+	unsigned int h = 5381;
+	for(int i=0; name[i] != 0; i++) {
+		h = ((h << 5) + h) + (unsigned char)name[i];
+	}
+	return h;
+}
+
+/* Index slot holding `name`, or the empty slot it would go in, or -1 if full. */
+int fileIndexSlot(const char* name) {
+	unsigned int h = hashFileName(name);
+	for(int i=0;i<FILE_INDEX_SIZE;i++) {
+		int slot = (h + i) & (FILE_INDEX_SIZE - 1);
+		if(fileIndex[slot].addr == NULL || strcmp(name, (char*)fileIndex[slot].name) == 0) {
+			return slot;
+		}
+	}
+	return -1;
+}
+
+void fileIndexInsert(flash_file* file) {
+	int slot = fileIndexSlot((char*)file->name);
+	if(slot < 0) {
+		fileIndexFull = true;
+		return;
+	}
+
+	memcpy(&fileIndex[slot], file, sizeof(flash_file));
+}
+
+void buildFileIndex() {
+	flash_file cur;
 
+	for(int i=0;i<FILE_INDEX_SIZE;i++) {
+		RCFS_FileInit(&fileIndex[i]);
+	}
+	RCFS_FileInit(&fileIndexTail);
+	fileIndexFull = false;
+	fileIndexBuilt = true;
+
+	RCFS_ReadVTOC();
+	RCFS_FileInit(&cur);
 	if(RCFS_FindFirstFile(&cur) < 0)
 		return;
 
+	int n = 0;
+	do {
+		fileIndexInsert(&cur);
+		memcpy(&fileIndexTail, &cur, sizeof(flash_file));
+		n++;
+	} while(RCFS_FindNextFile(&cur) >= 0);
+
 #ifdef DEBUG
-    int i = 0;
+	telemetryLog(TLM_FILES_INDEXED, n);
 #endif
+}
+
+/* Record a file just added to flash under `name`. */
+void fileIndexAdded(const char* name) {
+	if(!fileIndexBuilt) {
+		return;
+	}
+
+	/* The new file is the next VTOC entry after the last one seen. */
+	flash_file cur;
+	memcpy(&cur, &fileIndexTail, sizeof(flash_file));
+
+	int err;
+	if(cur.addr == NULL) {
+		err = RCFS_FindFirstFile(&cur);
+	} else {
+		err = RCFS_FindNextFile(&cur);
+	}
+
+	if(err < 0 || strcmp(name, (char*)cur.name) != 0) {
+		/* VTOC didn't pick it up (yet): rebuild on the next lookup. */
+		fileIndexBuilt = false;
+		return;
+	}
+
+	fileIndexInsert(&cur);
+	memcpy(&fileIndexTail, &cur, sizeof(flash_file));
+}
+
+void scanForFile(const char* name, flash_file* out) {
+		flash_file cur;
+
+    RCFS_FileInit(&cur);
+
+	if(RCFS_FindFirstFile(&cur) < 0)
+		return;
 
 	do {
 		if( strcmp(name, (char*)cur.name) == 0 ) {
 			memcpy(out, &cur, sizeof(flash_file));
-#ifdef DEBUG
-            i++;
-            writeDebugStreamLine("Found iteration %d of file %s.", i, name);
-#endif
 		}
 	} while(RCFS_FindNextFile(&cur) >= 0);
 }
 
+void findFile(const char* name, flash_file* out) {
+    RCFS_FileInit(out);
+
+	if(!fileIndexBuilt) {
+		buildFileIndex();
+	}
+
+	int slot = fileIndexSlot(name);
+	if(slot >= 0 && fileIndex[slot].addr != NULL) {
+		memcpy(out, &fileIndex[slot], sizeof(flash_file));
+	} else if(fileIndexFull) {
+		scanForFile(name, out);
+	}
+
+#ifdef DEBUG
+	telemetryLogName((out->addr != NULL) ? TLM_FILE_FOUND : TLM_FILE_MISSING, name);
+#endif
+}
+
 /*
- * Stream on-flash file format (current):
- *  2 bytes: stream size in bytes
- *  n bytes: stream data
+ * Stream on-flash file format (version 2):
+ *
+ * Replay file (named after the slot), multi-byte values little-endian:
+ *  2 bytes: magic, "RP"
+ *  1 byte:  format version (REPLAY_VERSION)
+ *  1 byte:  frame layout (REPLAY_LAYOUT_*)
+ *  1 byte:  frame rate in Hz (snapshotFreq unless the recorder set another)
+ *  1 byte:  frame size (set by the robot backend, up to REPLAY_MAX_FRAME_SIZE)
+ *  1 byte:  number of chunk files
+ *  1 byte:  number of keyframes (0 in version 1, where it was reserved)
+ *  2 bytes: file size in bytes (including this header)
+ *  2 bytes: frame count
+ *  2 bytes: tag
+ *  2 bytes: CRC-16/CCITT of the whole encoded stream (chunks first), followed
+ *           by the keyframe index and the 14 header bytes before it
+ *  n bytes: end of the encoded stream (see above)
+ *  6 bytes per keyframe, in stream order:
+ *           2 bytes: offset of its token in the whole stream (chunks first)
+ *           2 bytes: frame number
+ *           2 bytes: backend state (keyState)
+ *
+ * Chunk files "rec0", "rec1", ... (only for streams longer than one chunk):
+ *  2 bytes: tag of the replay file they belong to
+ *  REPLAY_CHUNK_SIZE bytes: encoded stream, in order
+ *
+ * The header is checked field by field on load, cheapest first, so that a
+ * file from another robot or an older build is turned away before anything
+ * else is read; the CRC is checked by validateReplay().
+ *
+ * Chunks are written while recording, before it is known whether (and to
+ * which slot) the replay will be saved, so the same chunk name gets reused by
+ * later recordings; the tag picks out the right copy.
+ *
+ * Flash files are only ever added, never removed or rewritten (RCFS has no
+ * call for either), and RAM only holds two chunks, so this has a cost: every
+ * chunk the writer spills takes REPLAY_CHUNK_SIZE + 2 bytes of flash, up to
+ * about 16 KB for REPLAY_MAX_CHUNKS, whether the recording is saved or not.
+ * Only re-flashing the Cortex gets it back; once RCFS_AddFile() runs out of
+ * room, recordings stop with the replay overflowed. The last full chunk is
+ * held back until REPLAY_SPILL_AT, so a discarded recording costs one chunk
+ * less than it would otherwise, and one of up to a chunk and a half (about 3
+ * KB of stream) costs nothing.
  */
 
-void saveReplayToFile(char* name, replay_t* repSt) {
+void chunkFileName(int n, char* out) {
+	sprintf(out, "rec%d", n);
+}
+
+/* Write a pending chunk to flash; called from the replayWriter task. */
+void flushReplayChunk(replay_t* data) {
+	if(!data->flushPending) {
+		return;
+	}
+
+	char name[16];
+	chunkFileName(data->nChunks - 1, name);
+
+	unsigned char* half = data->buffer + ((1 - data->activeHalf) * REPLAY_HALF_SIZE);
+	signed int err = RCFS_AddFile(half + REPLAY_HEADER_SIZE - 2, REPLAY_CHUNK_SIZE + 2, name);
+	if(err < 0) {
+		/* The replay is unusable without this chunk; stop recording. */
+		data->overflowed = true;
 #ifdef DEBUG
-	writeDebugStreamLine("Killed motors, now finding file:");
-	writeDebugStreamLine(name);
+		telemetryLog(TLM_CHUNK_FAILED, data->nChunks - 1, err);
 #endif
+	} else {
+		fileIndexAdded(name);
+	}
+
+	data->flushPending = false;
+}
+
+/*
+ * How far into the active half a pending chunk is left in RAM. The rest of
+ * the half is the time the writer has to get it into flash.
+ */
+#define REPLAY_SPILL_AT (REPLAY_HEADER_SIZE + (REPLAY_CHUNK_SIZE / 2))
+
+/* Whether the replayWriter task should write the pending chunk yet. */
+bool replayChunkDue(replay_t* data) {
+	return data->flushPending && (data->streamIndex >= REPLAY_SPILL_AT);
+}
+
+replay_t* replayWriterTarget = NULL;
+
+task replayWriter() {
+	while(true) {
+		if(replayWriterTarget != NULL && replayChunkDue(replayWriterTarget)) {
+			flushReplayChunk(replayWriterTarget);
+		}
+		sleep(5);
+	}
+}
+
+void startReplayWriter(replay_t* data) {
+	replayWriterTarget = data;
+	startTask(replayWriter, kLowPriority);
+}
+
+/*
+ * Wait for a chunk that is due to reach flash, then stop the writer. One
+ * that isn't stays in RAM for saveReplayToFile().
+ */
+void stopReplayWriter() {
+	while(replayWriterTarget != NULL && replayChunkDue(replayWriterTarget)) {
+		sleep(5);
+	}
+
+	stopTask(replayWriter);
+	replayWriterTarget = NULL;
+}
+
+/* Find the copy of chunk n that carries `tag`. */
+unsigned char* findChunk(int n, unsigned int tag) {
+	char name[16];
+	chunkFileName(n, name);
+
+	flash_file f;
+	findFile(name, &f);
+	if(f.addr != NULL && f.datalength >= REPLAY_CHUNK_SIZE + 2 && (unsigned int)(f.data[0] | (f.data[1] << 8)) == tag) {
+		return f.data;
+	}
+
+	/* Superseded by a later recording: look for older copies. */
+	flash_file cur;
+	RCFS_FileInit(&cur);
+	if(RCFS_FindFirstFile(&cur) < 0)
+		return NULL;
+
+	unsigned char* found = NULL;
+	do {
+		if(strcmp(name, (char*)cur.name) == 0 && cur.datalength >= REPLAY_CHUNK_SIZE + 2 && (unsigned int)(cur.data[0] | (cur.data[1] << 8)) == tag) {
+			found = cur.data;
+		}
+	} while(RCFS_FindNextFile(&cur) >= 0);
+
+	return found;
+}
 
-	  repSt->streamSize = repSt->streamIndex;
-    repSt->streamData[0] = (repSt->streamSize & 0xFF);
-    repSt->streamData[1] = ((repSt->streamSize & 0xFF00) >> 8) & 0xFF;
+void saveReplayToFile(const char* name, replay_t* repSt) {
+    /* Loaded replays point into flash and can't be patched up for saving. */
+    if(repSt->buffer == NULL) {
+#ifdef DEBUG
+        telemetryLog(TLM_READ_ONLY);
+#endif
+        return;
+    }
 
     clearLCDLine(0);
     clearLCDLine(1);
     displayLCDCenteredString(0, "! WRITING !");
 
+    flushReplayRun(repSt);
+    flushReplayChunk(repSt);
+
+	  repSt->headSize = repSt->streamIndex;
+
+    /*
+     * The index goes after the stream, which may run into the other half
+     * (in flash by now) or the start of the index itself: copy forwards.
+     */
+    unsigned int indexSize = repSt->nKeyframes * REPLAY_KEYFRAME_SIZE;
+    for(unsigned int i=0;i<indexSize;i++) {
+        repSt->streamData[repSt->headSize + i] = repSt->keyIndex[i];
+    }
+    unsigned int crc = replayCrc(repSt->crc, repSt->streamData + repSt->headSize, indexSize);
+    repSt->keyIndex = repSt->streamData + repSt->headSize;
+    repSt->headSize += indexSize;
+
+    repSt->streamData[0] = REPLAY_MAGIC_0;
+    repSt->streamData[1] = REPLAY_MAGIC_1;
+    repSt->streamData[2] = REPLAY_VERSION;
+    repSt->streamData[3] = repSt->layout;
+    repSt->streamData[4] = repSt->frameHz;
+    repSt->streamData[5] = repSt->frameSize;
+    repSt->streamData[6] = repSt->nChunks;
+    repSt->streamData[7] = repSt->nKeyframes;
+    repSt->streamData[8] = (repSt->headSize & 0xFF);
+    repSt->streamData[9] = ((repSt->headSize & 0xFF00) >> 8) & 0xFF;
+    repSt->streamData[10] = (repSt->frameCount & 0xFF);
+    repSt->streamData[11] = ((repSt->frameCount & 0xFF00) >> 8) & 0xFF;
+    repSt->streamData[12] = (repSt->tag & 0xFF);
+    repSt->streamData[13] = ((repSt->tag & 0xFF00) >> 8) & 0xFF;
+
+    /* The stream bytes went into the CRC as they were written. */
+    crc = replayCrc(crc, repSt->streamData, REPLAY_HEADER_SIZE - 2);
+    repSt->streamData[14] = (crc & 0xFF);
+    repSt->streamData[15] = ((crc & 0xFF00) >> 8) & 0xFF;
+
 #ifdef DEBUG
-    writeDebugStreamLine("BEGINNING WRITE!");
+    telemetryLog(TLM_SAVING, repSt->frameCount, repSt->nChunks, repSt->headSize);
 #endif
 
     signed int err = 0;
-    if((err = RCFS_AddFile((unsigned char*)repSt->streamData, repSt->streamSize, name)) < 0) {
+    if((err = RCFS_AddFile(repSt->streamData, repSt->headSize, (char*)name)) < 0) {
         clearLCDLine(0);
         displayLCDCenteredString(0, "Write failed!");
 #ifdef DEBUG
-        writeDebugStreamLine("Write failed, code: %d", err);
+        telemetryLog(TLM_SAVE_FAILED, err);
 #endif
-    }
-
+    } else {
+        fileIndexAdded(name);
 #ifdef DEBUG
-   writeDebugStreamLine("Write complete.");
+        telemetryLog(TLM_SAVED);
 #endif
+    }
 }
 
-void loadReplayFromFile(const char* name, replay_t* repSt) {
+/*
+ * Check a replay file's header against this program, one field at a time,
+ * without touching the stream. `length` is the size of the file in flash.
+ * Returns 0 if the header is fine, else the REPLAY_BAD_* check that failed
+ * (and the value found in `value`).
+ */
+int checkReplayHeader(unsigned char* head, unsigned int length, int layout, int* value) {
+	int bad = 0;
+	unsigned int size = 0;
+
+	if(length < REPLAY_HEADER_SIZE || head[0] != REPLAY_MAGIC_0 || head[1] != REPLAY_MAGIC_1) {
+		bad = REPLAY_BAD_MAGIC;
+		*value = length;
+	} else if(head[2] < 1 || head[2] > REPLAY_VERSION) {
+		bad = REPLAY_BAD_VERSION;
+		*value = head[2];
+	} else if(layout != REPLAY_LAYOUT_ANY && head[3] != REPLAY_LAYOUT_ANY && head[3] != layout) {
+		bad = REPLAY_BAD_LAYOUT;
+		*value = head[3];
+	} else if(head[4] == 0) {
+		bad = REPLAY_BAD_RATE;
+		*value = head[4];
+	} else if(head[5] < 1 || head[5] > REPLAY_MAX_FRAME_SIZE) {
+		bad = REPLAY_BAD_FRAME_SIZE;
+		*value = head[5];
+	} else if(head[6] > REPLAY_MAX_CHUNKS) {
+		bad = REPLAY_BAD_CHUNKS;
+		*value = head[6];
+	} else if(head[7] > REPLAY_MAX_KEYFRAMES) {
+		bad = REPLAY_BAD_INDEX;
+		*value = head[7];
+	} else {
+		/* Never read past the end of the file, whatever the header says. */
+		size = head[8] | (((unsigned int)head[9]) << 8);
+		if(size < REPLAY_HEADER_SIZE + ((unsigned int)head[7] * REPLAY_KEYFRAME_SIZE) || size > length) {
+			bad = REPLAY_BAD_SIZE;
+			*value = size;
+		}
+	}
+
+	return bad;
+}
+
+/* `layout` is the robot's REPLAY_LAYOUT_*; replays recorded by another robot are rejected. */
+void loadReplayFromFile(const char* name, replay_t* repSt, int layout = REPLAY_LAYOUT_ANY) {
 	clearLCDLine(0);
 	clearLCDLine(1);
-#ifdef DEBUG
-	writeDebugStreamLine("Attempting to load stream:");
-	writeDebugStreamLine(name);
-#endif
 	displayLCDCenteredString(0, "Finding file...");
 
 	flash_file fHandle;
 	findFile(name, &fHandle);
 	if(fHandle.addr != NULL) {
+		int badValue = 0;
+		int bad = checkReplayHeader(fHandle.data, fHandle.datalength, layout, &badValue);
+		if(bad != 0) {
 #ifdef DEBUG
-		writeDebugStreamLine("Found file!");
+			telemetryLog(TLM_BAD_REPLAY, bad, badValue);
 #endif
+			clearLCDLine(0);
+			displayLCDCenteredString(0, "Bad replay!");
+			return;
+		}
 
-		displayLCDCenteredString(0, "Loading replay...");
+		/* Read in place: the stream is only ever played back once, in order. */
+		repSt->headData = fHandle.data;
+		repSt->layout = fHandle.data[3];
+		repSt->frameHz = fHandle.data[4];
+		repSt->frameSize = fHandle.data[5];
+		repSt->nChunks = fHandle.data[6];
+		repSt->headSize = (fHandle.data[8] | (((unsigned int)(fHandle.data[9])) << 8));
+		repSt->frameCount = (fHandle.data[10] | (((unsigned int)(fHandle.data[11])) << 8));
+		repSt->tag = (fHandle.data[12] | (((unsigned int)(fHandle.data[13])) << 8));
+		repSt->crc = (fHandle.data[14] | (((unsigned int)(fHandle.data[15])) << 8));
+		repSt->nKeyframes = fHandle.data[7]; // 0 in version 1 files
+		repSt->keyIndex = fHandle.data + repSt->headSize - (repSt->nKeyframes * REPLAY_KEYFRAME_SIZE);
+		repSt->streamCapacity = 0;
 
-		unsigned int streamSz = (fHandle.data[0] | (((unsigned int)(fHandle.data[1])) << 8));
-		for(unsigned int i=0;i<streamSz;i++) {
-			repSt->streamData[i] = fHandle.data[i];
+		for(int i=0;i<repSt->nChunks;i++) {
+			repSt->chunkData[i] = findChunk(i, repSt->tag);
+			if(repSt->chunkData[i] == NULL) {
+				clearLCDLine(0);
+				displayLCDCenteredString(0, "Chunk missing!");
+#ifdef DEBUG
+				telemetryLog(TLM_CHUNK_MISSING, i);
+#endif
+				return;
+			}
 		}
-		repSt->streamSize = streamSz;
 
 #ifdef DEBUG
-		writeDebugStreamLine("Loaded %i bytes.", streamSz);
+		telemetryLog(TLM_LOADED, repSt->frameCount, repSt->nChunks, repSt->headSize);
 #endif
 
-    repSt->streamIndex = 2; // stream filesize = 2 bytes at positions 0-1
+    rewindReplay(repSt);
     repSt->loaded = true;
 	} else {
 		clearLCDLine(0);
 		displayLCDCenteredString(0, "File not found!");
-#ifdef DEBUG
-		writeDebugStreamLine("Could not find file.");
-#endif
 	}
 }
 
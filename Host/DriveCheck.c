@@ -0,0 +1,474 @@
+/*
+ * DriveCheck.c: host checks of the Akagi drive and recorder code
+ * (3631A/Akagi.c, 3631A/Recorder.c) that need to be run again whenever it
+ * changes.
+ *
+ * Build:
+ *   g++ -x c++ -O2 -Wno-unknown-pragmas -IHost Host/DriveCheck.c -o drive-check
+ *
+ * Usage:
+ *   drive-check [-n calls]
+ *
+ * moveControl: the integer moveControl() against the float version it
+ * replaced, over every yAxis/zAxis pair with every button combination that
+ * affects the drive and a range of speed limits; then both timed over
+ * `calls` calls (default 20000000).
+ *
+ * Recorded sticks: moveControl() on the sticks as controlStateToReplay()
+ * records them (recordedAxis()) against the raw sticks, over every pair,
+ * button combination and playback driveScale, so that quantizing them
+ * never changes a motor command (slow mode's speedDiv included).
+ *
+ * Recording length: a full-length recording (the recorder's timelimit, 61
+ * s, at recordFreq with sensor deltas and keyframes, as 3631A/Recorder.c
+ * records) of a drive around the plant model with jittery sticks, which
+ * must fit in REPLAY_MAX_CHUNKS chunks without overflowing. The same at
+ * OPT_IN_RECORD_FREQ is only reported.
+ *
+ * Chunk writer: the same drive recorded as 3631A/Recorder.c does, as a task
+ * with the low-priority replayWriter task writing chunks behind it under
+ * the host scheduler, against the same recording flushed in the loop. With
+ * flash writes that take up to SLOW_FLASH_MS the stream must come out the
+ * same and the saved replay must load and validate; a take that is
+ * discarded before its held-back chunk is due must leave no chunk files;
+ * and with flash writes too slow to keep up the recording must stop
+ * overflowed, with what it got still saving cleanly.
+ *
+ * Exits with status 1 if any check fails.
+ */
+
+#include <getopt.h>
+#include <time.h>
+
+#include "Robot3631A.h"
+
+void hostPlantStep(long dt) {
+	hostRobotStep(dt);
+}
+
+#include "../Enterprise.c"
+#include "../3631A/Akagi.c"
+
+/* moveControl() as it was before slow mode went integer, for reference. */
+void moveControlFloat(control_t* state) {
+	if( state->turnLeft || state->turnRight ) {
+		/* Rotation inputs: */
+		motor[LBack] = motor[LFront] = (state->turnLeft ? -1*manualTurnOut : manualTurnOut);
+		motor[RBack] = motor[RFront] = (state->turnLeft ? manualTurnOut : -1*manualTurnOut);
+	} else {
+		/* Set speedlimit as appropriate: */
+		float speedMult = 1.0;
+		if(state->slowDown) {
+			state->speedLimit = fastSpeedLimit;
+			speedMult = 0.5;
+		} else {
+			state->speedLimit = fastSpeedLimit;
+		}
+
+		short yAxis = (abs(state->yAxis) < deadband) ? 0 : -state->yAxis;
+		short zAxis = (abs(state->zAxis) < deadband) ? 0 : -state->zAxis;
+
+		short right = yAxis - zAxis;
+		short left = yAxis + zAxis;
+
+		right = (abs(right) > state->speedLimit) ? (sgn(right)*state->speedLimit) : right;
+		left = (abs(left) > state->speedLimit) ? (sgn(left)*state->speedLimit) : left;
+
+		motor[RFront] = motor[RBack] = (signed char)((float)right * speedMult);
+		motor[LFront] = motor[LBack] = (signed char)((float)left * speedMult);
+	}
+}
+
+struct drive_out_t {
+	int lf, lb, rf, rb;
+	unsigned int speedLimit;
+};
+
+void driveOut(control_t* state, drive_out_t* out) {
+	out->lf = motor[LFront];
+	out->lb = motor[LBack];
+	out->rf = motor[RFront];
+	out->rb = motor[RBack];
+	out->speedLimit = state->speedLimit;
+}
+
+bool sameDrive(drive_out_t* a, drive_out_t* b) {
+	return a->lf == b->lf && a->lb == b->lb && a->rf == b->rf && a->rb == b->rb && a->speedLimit == b->speedLimit;
+}
+
+/* Bits 0..2 of `buttons`: slowDown, turnLeft, turnRight. */
+void setDriveButtons(control_t* state, int buttons) {
+	state->slowDown = (buttons & 1) != 0;
+	state->turnLeft = (buttons & 2) != 0;
+	state->turnRight = (buttons & 4) != 0;
+}
+
+/* Around the real limits, and past 127 where a signed char output wraps. */
+const int speedLimits[] = { 0, 1, 24, 48, 95, 96, 97, 126, 127, 128, 200, 255, 256, 1000 };
+#define N_SPEED_LIMITS ((int)(sizeof(speedLimits) / sizeof(speedLimits[0])))
+
+bool checkMoveControl() {
+	control_t a, b;
+	initState(&a);
+	initState(&b);
+
+	long cases = 0, differ = 0;
+	for(int s=0;s<N_SPEED_LIMITS;s++) {
+		fastSpeedLimit = speedLimits[s];
+		for(int buttons=0;buttons<8;buttons++) {
+			for(int y=-128;y<=127;y++) {
+				for(int z=-128;z<=127;z++) {
+					drive_out_t want, got;
+
+					a.yAxis = b.yAxis = y;
+					a.zAxis = b.zAxis = z;
+					setDriveButtons(&a, buttons);
+					setDriveButtons(&b, buttons);
+
+					moveControlFloat(&a);
+					driveOut(&a, &want);
+					moveControl(&b);
+					driveOut(&b, &got);
+
+					cases++;
+					if(!sameDrive(&want, &got)) {
+						if(differ < 10) {
+							printf("  y %d z %d buttons %d limit %d: float %d %d / %d %d, int %d %d / %d %d\n",
+								y, z, buttons, fastSpeedLimit, want.lf, want.lb, want.rf, want.rb, got.lf, got.lb, got.rf, got.rb);
+						}
+						differ++;
+					}
+				}
+			}
+		}
+	}
+	fastSpeedLimit = 96;
+
+	printf("moveControl: %ld cases, %ld differ from the float version\n", cases, differ);
+	return differ == 0;
+}
+
+/* Playback speeds to cover; moveControl() scales the sticks by driveScale. */
+const int driveScales[] = { 25, 50, 75, 100, 125, 150, 200, 400 };
+#define N_DRIVE_SCALES ((int)(sizeof(driveScales) / sizeof(driveScales[0])))
+
+/* Stick values last recorded, which stand while a turn button is held. */
+const int lastRecorded[] = { -128, -25, 0, 24, 127 };
+#define N_LAST_RECORDED ((int)(sizeof(lastRecorded) / sizeof(lastRecorded[0])))
+
+bool checkRecordedSticks() {
+	control_t raw, rec;
+	initState(&raw);
+	initState(&rec);
+
+	long cases = 0, differ = 0;
+	for(int s=0;s<N_DRIVE_SCALES;s++) {
+		raw.driveScale = rec.driveScale = driveScales[s];
+		for(int l=0;l<N_LAST_RECORDED;l++) {
+			for(int buttons=0;buttons<8;buttons++) {
+				setDriveButtons(&raw, buttons);
+				setDriveButtons(&rec, buttons);
+
+				for(int y=-128;y<=127;y++) {
+					for(int z=-128;z<=127;z++) {
+						drive_out_t want, got;
+
+						raw.yAxis = y;
+						raw.zAxis = z;
+						rec.yAxis = recordedAxis(&raw, y, lastRecorded[l]);
+						rec.zAxis = recordedAxis(&raw, z, lastRecorded[l]);
+
+						moveControl(&raw);
+						driveOut(&raw, &want);
+						moveControl(&rec);
+						driveOut(&rec, &got);
+
+						cases++;
+						if(!sameDrive(&want, &got)) {
+							if(differ < 10) {
+								printf("  y %d z %d (recorded %d %d) buttons %d scale %d: raw %d %d / %d %d, recorded %d %d / %d %d\n",
+									y, z, rec.yAxis, rec.zAxis, buttons, raw.driveScale,
+									want.lf, want.lb, want.rf, want.rb, got.lf, got.lb, got.rf, got.rb);
+							}
+							differ++;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	printf("recorded sticks: %ld cases, %ld change a motor command\n", cases, differ);
+	return differ == 0;
+}
+
+#define CHECK_RECORD_MS 61000  /* 3631A/Recorder.c's timelimit */
+#define OPT_IN_RECORD_FREQ 100  /* see recordFreq */
+
+/*
+ * Sticks for a drive that keeps moving the whole time, as in a skills run,
+ * plus up to `jitter` of noise on each stick in every frame. Buttons now
+ * and then, to fire and hang.
+ */
+void scriptedDrive(control_t* state, long ms, int jitter) {
+	double t = ms / 1000.0;
+	state->yAxis = (int)((-70 * sin(t * 1.3)) + (25 * sin(t * 3.1)));
+	state->zAxis = (int)((45 * sin((t * 0.9) + 1)) + (20 * sin(t * 2.3)));
+	if(jitter > 0) {
+		state->yAxis += (rand() % ((2 * jitter) + 1)) - jitter;
+		state->zAxis += (rand() % ((2 * jitter) + 1)) - jitter;
+	}
+
+	state->catDown = (ms % 7000) < 200;
+	state->hangUp = (ms % 11000) < 300;
+	state->turnLeft = (ms % 13000) < 400;
+}
+
+/* Stream bytes used by a recording at `hz`, or -1 if it overflowed. */
+long recordDrive(int hz, int jitter) {
+	static unsigned char buffer[REPLAY_BUFFER_SIZE];
+	replay_t replay;
+	control_t state;
+
+	srand(1);
+	initState(&state);
+	initReplayBuffer(&replay, buffer, replayFrameSize(), REPLAY_LAYOUT_AKAGI);
+	setReplayFrameRate(&replay, hz);
+	setReplayKeyframeInterval(&replay, hz);
+
+	long frames = ((long)CHECK_RECORD_MS * hz) / 1000;
+	for(long f=0;f<frames;f++) {
+		scriptedDrive(&state, (f * 1000) / hz, jitter);
+		controlLoopIteration(&state);
+		controlStateToReplay(&state, &replay);
+		flushReplayChunk(&replay); // no replayWriter task here
+		hostRobotStep(1000 / hz);
+
+		if(replayOverflowed(&replay)) {
+			printf("  jitter %2d: full after %.2f s\n", jitter, f / (double)hz);
+			return -1;
+		}
+	}
+
+	flushReplayRun(&replay);
+	return replayStreamOffset(&replay);
+}
+
+#define WRITER_JITTER 8
+#define SLOW_FLASH_MS 2000   /* far slower than RCFS, still within half a chunk */
+#define STALLED_FLASH_MS 30000
+
+/* recordTask()'s settings and results. */
+bool recordSync;              /* flush in the loop instead of the writer task */
+long recordStopAt;            /* stream bytes to stop at (0: the full timelimit) */
+replay_t taskReplay;
+long taskChunkFiles;          /* chunk files written by the time recording stopped */
+
+/* The recording loop of 3631A/Recorder.c, without the LCD and the overdub. */
+task recordTask() {
+	static unsigned char buffer[REPLAY_BUFFER_SIZE];
+	control_t state;
+
+	srand(1);
+	hostRobotReset();
+	initState(&state);
+	initReplayBuffer(&taskReplay, buffer, replayFrameSize(), REPLAY_LAYOUT_AKAGI);
+	setReplayFrameRate(&taskReplay, recordFreq);
+	setReplayKeyframeInterval(&taskReplay, recordFreq);
+
+	int files = hostFlashCount;
+	if(!recordSync) {
+		startReplayWriter(&taskReplay);
+	}
+
+	ticker_t ticker;
+	tickerStart(&ticker, recordFreq);
+
+	while(true) {
+		scriptedDrive(&state, tickerTime(&ticker), WRITER_JITTER);
+		controlLoopIteration(&state);
+		controlStateToReplay(&state, &taskReplay);
+		if(recordSync) {
+			flushReplayChunk(&taskReplay);
+		}
+
+		if(replayOverflowed(&taskReplay)) {
+			break;
+		}
+		if(recordStopAt > 0 && replayStreamOffset(&taskReplay) >= recordStopAt) {
+			break;
+		}
+		if(tickerTimeAt(&ticker, ticker.ticks+1) > CHECK_RECORD_MS) {
+			break;
+		}
+
+		tickerWait(&ticker);
+	}
+
+	if(!recordSync) {
+		stopReplayWriter();
+	}
+	taskChunkFiles = hostFlashCount - files;
+}
+
+struct recording_t {
+	unsigned int frames, offset, crc;
+	int chunks;
+};
+
+/*
+ * Record under the scheduler with flash writes taking `writeMs`, then save
+ * the take (unless `discard`) and load it back. Returns false if the saved
+ * replay doesn't load and validate.
+ */
+bool recordWithWriter(bool sync, long writeMs, long stopAt, bool discard, recording_t* out) {
+	recordSync = sync;
+	recordStopAt = stopAt;
+	hostFlashWriteMs = writeMs;
+	startTask(recordTask);
+	hostRunTasks(0);
+	hostFlashWriteMs = 0;
+
+	flushReplayRun(&taskReplay);
+	out->frames = taskReplay.frameCount;
+	out->offset = replayStreamOffset(&taskReplay);
+	out->crc = taskReplay.crc;
+	out->chunks = taskReplay.nChunks;
+	if(discard) {
+		return true;
+	}
+
+	replay_t loaded;
+	initReplayData(&loaded);
+	saveReplayToFile("writer", &taskReplay);
+	loadReplayFromFile("writer", &loaded, REPLAY_LAYOUT_AKAGI);
+	return loaded.loaded && validateReplay(&loaded) && loaded.frameCount == out->frames;
+}
+
+bool sameRecording(recording_t* a, recording_t* b) {
+	return a->frames == b->frames && a->offset == b->offset && a->crc == b->crc && a->chunks == b->chunks;
+}
+
+bool checkChunkWriter() {
+	recording_t want, got;
+	bool ok = true;
+
+	printf("chunk writer: %d s at %d Hz, jitter %d\n", CHECK_RECORD_MS / 1000, recordFreq, WRITER_JITTER);
+	if(!recordWithWriter(true, 0, 0, false, &want)) {
+		printf("  flushed in the loop: doesn't load back\n");
+		return false;
+	}
+	printf("  flushed in the loop: %u frames, %u bytes, %d chunks\n", want.frames, want.offset, want.chunks);
+
+	const long writeMs[] = { 0, 20, SLOW_FLASH_MS };
+	for(int i=0;i<3;i++) {
+		bool loads = recordWithWriter(false, writeMs[i], 0, false, &got);
+		bool same = sameRecording(&want, &got) && !replayOverflowed(&taskReplay);
+		printf("  writer, %5ld ms writes: %s%s\n", writeMs[i], same ? "same stream" : "DIFFERENT stream", loads ? "" : ", doesn't load back");
+		ok = ok && same && loads;
+	}
+
+	/* Past the first chunk, but stopped before it is due. */
+	long stopAt = REPLAY_CHUNK_SIZE + ((REPLAY_SPILL_AT - REPLAY_HEADER_SIZE) / 2);
+	int files = hostFlashCount;
+	recordWithWriter(false, 0, stopAt, true, &got);
+	printf("  discarded at %u bytes (%d chunk): %d files written\n", got.offset, got.chunks, hostFlashCount - files);
+	ok = ok && got.chunks == 1 && hostFlashCount == files;
+
+	bool loads = recordWithWriter(false, 0, stopAt, false, &got);
+	printf("  saved at %u bytes: %d files written%s\n", got.offset, hostFlashCount - files, loads ? "" : ", doesn't load back");
+	ok = ok && loads && hostFlashCount == files + 2;
+
+	loads = recordWithWriter(false, STALLED_FLASH_MS, 0, false, &got);
+	bool stopped = replayOverflowed(&taskReplay) && got.frames < want.frames;
+	printf("  writer, %5d ms writes: %s after %.2f s%s\n", STALLED_FLASH_MS, stopped ? "overflowed" : "did NOT overflow",
+		got.frames / (double)recordFreq, loads ? "" : ", doesn't load back");
+	ok = ok && stopped && loads;
+
+	return ok;
+}
+
+const int stickJitter[] = { 0, 2, 4, 8, 16 };
+#define N_STICK_JITTER ((int)(sizeof(stickJitter) / sizeof(stickJitter[0])))
+
+/* Whether every recording at `hz` fits. */
+bool checkRecordingLengthAt(int hz) {
+	long capacity = ((REPLAY_MAX_CHUNKS + 1) * (long)REPLAY_CHUNK_SIZE);  /* chunks, then the replay file */
+	bool ok = true;
+
+	printf("recording length: %d s at %d Hz, room for %ld bytes\n", CHECK_RECORD_MS / 1000, hz, capacity);
+	for(int i=0;i<N_STICK_JITTER;i++) {
+		long used = recordDrive(hz, stickJitter[i]);
+		if(used < 0) {
+			ok = false;
+		} else {
+			printf("  jitter %2d: %ld bytes (%ld%%)\n", stickJitter[i], used, (100 * used) / capacity);
+		}
+	}
+	return ok;
+}
+
+bool checkRecordingLength() {
+	bool ok = checkRecordingLengthAt(recordFreq);
+	if(recordFreq != OPT_IN_RECORD_FREQ) {
+		printf("(at %d Hz, for reference only:)\n", OPT_IN_RECORD_FREQ);
+		checkRecordingLengthAt(OPT_IN_RECORD_FREQ);
+	}
+	return ok;
+}
+
+double secondsSince(struct timespec* start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + ((now.tv_nsec - start->tv_nsec) / 1e9);
+}
+
+/* Both versions over the same inputs, slow mode on half the time. */
+void timeMoveControl(long calls) {
+	control_t state;
+	initState(&state);
+
+	for(int version=0;version<2;version++) {
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		for(long i=0;i<calls;i++) {
+			state.yAxis = (signed char)(i * 7);
+			state.zAxis = (signed char)(i * 13);
+			state.slowDown = (i & 1024) != 0;
+			if(version == 0) {
+				moveControlFloat(&state);
+			} else {
+				moveControl(&state);
+			}
+		}
+
+		double s = secondsSince(&start);
+		printf("  %-5s %.2f ns/call\n", (version == 0) ? "float" : "int", (s * 1e9) / calls);
+	}
+	printf("  (host FPU; the Cortex-M3 has none, so float there is soft-float calls)\n");
+}
+
+int main(int argc, char** argv) {
+	long calls = 20000000;
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:")) != -1) {
+		switch(opt) {
+		case 'n':
+			calls = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n calls]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	bool ok = checkMoveControl();
+	ok = checkRecordedSticks() && ok;
+	ok = checkRecordingLength() && ok;
+	ok = checkChunkWriter() && ok;
+	timeMoveControl(calls);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,202 @@
+#ifndef FLASHLIB_H
+#define FLASHLIB_H
+
+/*
+ * FlashLib.h: host-side stand-in for jpearman's RCFS (see the rcfs submodule).
+ *
+ * Files live in RAM, in the order they were added; like the real VTOC, adding
+ * a file with an existing name leaves the old copy in place and later lookups
+ * are expected to take the last match.
+ *
+ * hostFlashLoadDir() seeds the "flash" from a directory (one file per
+ * replay, named after the replay); if a directory was loaded, RCFS_AddFile()
+ * writes new files back to it. The directory keeps old copies too: the
+ * newest copy of a file goes by its own name, and the ones it replaced by
+ * "name.1", "name.2", ... oldest first, which load back in that order. A
+ * chunk file from one recording is then still there after another
+ * recording writes one of the same name.
+ */
+
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#ifndef MAX_FLASH_FILE_SIZE
+#define MAX_FLASH_FILE_SIZE 10810
+#endif
+
+#define FLASH_FILE_NAME_LEN 16
+#define HOST_FLASH_MAX_FILES 128
+
+struct flash_file {
+	unsigned char name[FLASH_FILE_NAME_LEN];
+	unsigned char* addr;
+	unsigned char* data;
+	int datalength;
+	int index;
+};
+
+struct host_flash_entry_t {
+	char name[FLASH_FILE_NAME_LEN];
+	unsigned char* data;
+	int length;
+};
+
+host_flash_entry_t hostFlash[HOST_FLASH_MAX_FILES];
+int hostFlashCount = 0;
+const char* hostFlashDir = NULL;
+long hostFlashWriteMs = 0;  /* how long RCFS_AddFile() takes (from a task) */
+
+void RCFS_FileInit(flash_file* f) {
+	memset(f, 0, sizeof(flash_file));
+	f->index = -1;
+}
+
+void RCFS_ReadVTOC() {}
+
+int hostFlashFill(flash_file* f, int idx) {
+	if(idx < 0 || idx >= hostFlashCount) {
+		return -1;
+	}
+
+	memcpy(f->name, hostFlash[idx].name, FLASH_FILE_NAME_LEN);
+	f->addr = hostFlash[idx].data;
+	f->data = hostFlash[idx].data;
+	f->datalength = hostFlash[idx].length;
+	f->index = idx;
+	return 0;
+}
+
+int RCFS_FindFirstFile(flash_file* f) {
+	return hostFlashFill(f, 0);
+}
+
+int RCFS_FindNextFile(flash_file* f) {
+	return hostFlashFill(f, f->index + 1);
+}
+
+int hostFlashAdd(const char* name, const unsigned char* data, int length) {
+	if(hostFlashCount >= HOST_FLASH_MAX_FILES || length > MAX_FLASH_FILE_SIZE) {
+		return -1;
+	}
+
+	host_flash_entry_t* e = &hostFlash[hostFlashCount];
+	memset(e->name, 0, sizeof(e->name));
+	strncpy(e->name, name, FLASH_FILE_NAME_LEN-1);
+	e->data = (unsigned char*)malloc(length > 0 ? length : 1);
+	memcpy(e->data, data, length);
+	e->length = length;
+	hostFlashCount++;
+	return 0;
+}
+
+int RCFS_AddFile(unsigned char* data, int length, char* name) {
+	if(hostFlashWriteMs > 0) {
+		hostSleep(hostFlashWriteMs);
+	}
+
+	if(hostFlashAdd(name, data, length) < 0) {
+		return -1;
+	}
+
+	if(hostFlashDir != NULL) {
+		char path[1024], old[1040];
+		snprintf(path, sizeof(path), "%s/%s", hostFlashDir, name);
+		struct stat st;
+		if(stat(path, &st) == 0) {
+			for(int k=1;;k++) {
+				snprintf(old, sizeof(old), "%s.%d", path, k);
+				if(stat(old, &st) != 0) {
+					break;
+				}
+			}
+			rename(path, old);
+		}
+
+		FILE* fp = fopen(path, "wb");
+		if(fp != NULL) {
+			fwrite(data, 1, length, fp);
+			fclose(fp);
+		}
+	}
+
+	return 0;
+}
+
+struct host_flash_name_t {
+	char* file;                       /* name in the directory */
+	char name[FLASH_FILE_NAME_LEN];   /* name in flash */
+	long copy;                        /* "name.copy", or LONG_MAX for the newest */
+};
+
+void hostFlashParseName(host_flash_name_t* n, char* file) {
+	n->file = file;
+	n->copy = LONG_MAX;
+	memset(n->name, 0, sizeof(n->name));
+
+	const char* dot = strrchr(file, '.');
+	char* end = NULL;
+	if(dot != NULL && dot != file && dot[1] != '\0') {
+		long copy = strtol(dot + 1, &end, 10);
+		if(*end == '\0' && copy > 0) {
+			n->copy = copy;
+			strncpy(n->name, file, ((dot - file) < FLASH_FILE_NAME_LEN) ? (dot - file) : FLASH_FILE_NAME_LEN-1);
+			return;
+		}
+	}
+	strncpy(n->name, file, FLASH_FILE_NAME_LEN-1);
+}
+
+/* By name, then copies oldest first. */
+int hostFlashNameCmp(const void* a, const void* b) {
+	const host_flash_name_t* x = (const host_flash_name_t*)a;
+	const host_flash_name_t* y = (const host_flash_name_t*)b;
+	int c = strcmp(x->name, y->name);
+	if(c != 0) {
+		return c;
+	}
+	return (x->copy < y->copy) ? -1 : ((x->copy > y->copy) ? 1 : 0);
+}
+
+/* Load every regular file in `dir`, in name order. Returns the file count. */
+int hostFlashLoadDir(const char* dir) {
+	DIR* d = opendir(dir);
+	if(d == NULL) {
+		return -1;
+	}
+
+	host_flash_name_t names[HOST_FLASH_MAX_FILES];
+	int n = 0;
+	struct dirent* ent;
+	while((ent = readdir(d)) != NULL && n < HOST_FLASH_MAX_FILES) {
+		if(ent->d_name[0] != '.') {
+			hostFlashParseName(&names[n++], strdup(ent->d_name));
+		}
+	}
+	closedir(d);
+
+	qsort(names, n, sizeof(host_flash_name_t), hostFlashNameCmp);
+
+	int loaded = 0;
+	for(int i=0;i<n;i++) {
+		char path[1024];
+		snprintf(path, sizeof(path), "%s/%s", dir, names[i].file);
+
+		FILE* fp = fopen(path, "rb");
+		if(fp != NULL) {
+			unsigned char buf[MAX_FLASH_FILE_SIZE];
+			int len = fread(buf, 1, sizeof(buf), fp);
+			fclose(fp);
+
+			if(hostFlashAdd(names[i].name, buf, len) == 0) {
+				loaded++;
+			}
+		}
+		free(names[i].file);
+	}
+
+	hostFlashDir = dir;
+	return loaded;
+}
+
+#endif /* end of include guard: FLASHLIB_H */
@@ -0,0 +1,182 @@
+/*
+ * MotionCheck.c: host checks of the profiled moves in
+ * 3631A/CompetitionControl.c against the plant model, that need to be run
+ * again whenever they or their tuning change.
+ *
+ * Build:
+ *   g++ -x c++ -O2 -Wno-unknown-pragmas -IHost Host/MotionCheck.c -o motion-check
+ *
+ * Usage:
+ *   motion-check
+ *
+ * Straight lines: driveStraightLine() over a range of distances, forwards
+ * and back, at a range of cruise speeds, on the nominal plant and with
+ * either side 15% weak. Every move must settle before its timeout, end up
+ * within driveSettleTicks of the target on both sides once the robot has
+ * coasted to a stop, and keep its heading within MAX_DRIFT. The same with
+ * one side 30% weak is only reported.
+ *
+ * Turns: turnArbitraryAngle() with this robot's turnTuning, over a range of
+ * angles both ways, on the same plants. Every turn must settle within
+ * MAX_TURN_OVERRUN of the planned turn (a feedforward that is off shows up
+ * there long before it costs a timeout) and end within
+ * turnTuning.tolerance of the target once the robot has coasted to a stop.
+ *
+ * Exits with status 1 if any check fails.
+ */
+
+#include "Robot3631A.h"
+
+void hostPlantStep(long dt) {
+	hostRobotStep(dt);
+}
+
+/* Everything but the competition template, whose main() this replaces. */
+#define VEX_COMPETITION_INCLUDES_C
+#include "FlashLib.h"
+#include "../3631A/CompetitionControl.c"
+
+#define COAST_MS 1000
+#define MAX_DRIFT 5     /* gyro tenths of a degree */
+#define MAX_TURN_OVERRUN 200  /* ms */
+
+struct plant_t {
+	const char* name;
+	double left, right;  /* hostLeftGain, hostRightGain */
+	bool checked;        /* else only reported */
+};
+
+const plant_t plants[] = {
+	{ "nominal", 1.0, 1.0, true },
+	{ "left 0.85", 0.85, 1.0, true },
+	{ "right 0.85", 1.0, 0.85, true },
+	{ "left 0.70", 0.70, 1.0, false },
+};
+#define N_PLANTS ((int)(sizeof(plants) / sizeof(plants[0])))
+
+/* Run `move` as a task from rest, then let the robot coast to a stop. Returns how long the move took. */
+long runMove(const plant_t* plant, void (*move)()) {
+	hostRobotReset();
+	hostLeftGain = plant->left;
+	hostRightGain = plant->right;
+
+	long start = hostClock;
+	hostStartTask(move, "move");
+	hostRunTasks(0);
+	long took = hostClock - start;
+
+	hostSleep(COAST_MS);
+	return took;
+}
+
+const float driveDistances[] = { 3, 6, 12, 24, 48, 72, -12, -24, -48 };
+#define N_DRIVE_DISTANCES ((int)(sizeof(driveDistances) / sizeof(driveDistances[0])))
+
+const short cruiseSpeeds[] = { 45, 100, 127 };
+#define N_CRUISE_SPEEDS ((int)(sizeof(cruiseSpeeds) / sizeof(cruiseSpeeds[0])))
+
+float moveInches;
+short moveSpeed;
+
+task driveMove() {
+	driveStraightLine(moveInches, moveSpeed);
+}
+
+bool checkStraightLines() {
+	bool ok = true;
+
+	printf("straight lines: %d distances x %d cruise speeds, settle within %d ticks, drift within %d\n",
+		N_DRIVE_DISTANCES, N_CRUISE_SPEEDS, driveSettleTicks, MAX_DRIFT);
+	for(int p=0;p<N_PLANTS;p++) {
+		int worstError = 0, worstDrift = 0, timeouts = 0;
+		long worstOverrun = 0;
+
+		for(int s=0;s<N_CRUISE_SPEEDS;s++) {
+			for(int d=0;d<N_DRIVE_DISTANCES;d++) {
+				moveInches = driveDistances[d];
+				moveSpeed = cruiseSpeeds[s];
+				long took = runMove(&plants[p], driveMove);
+
+				profile_t profile;
+				int target = (int)(moveInches * ticksPerInch);
+				profileInit(&profile, target, driveMaxTicksPerSec * moveSpeed / 127.0, driveAccel);
+				long overrun = took - (long)(profile.tTotal * 1000);
+
+				int leftError = getLeftEncoder() - target;
+				int rightError = getRightEncoder() - target;
+				int error = (abs(leftError) > abs(rightError)) ? abs(leftError) : abs(rightError);
+				int drift = abs(getGyroAngle());
+				bool timedOut = (overrun >= driveTimeoutMs);
+
+				worstError = (error > worstError) ? error : worstError;
+				worstDrift = (drift > worstDrift) ? drift : worstDrift;
+				worstOverrun = (overrun > worstOverrun) ? overrun : worstOverrun;
+				timeouts += timedOut ? 1 : 0;
+
+				if(plants[p].checked && (timedOut || error > driveSettleTicks || drift > MAX_DRIFT)) {
+					printf("  %s: %.0f in at %d: %ld ms (profile %.0f), error %d %d, drift %d\n", plants[p].name,
+						moveInches, moveSpeed, took, profile.tTotal * 1000, leftError, rightError, drift);
+					ok = false;
+				}
+			}
+		}
+
+		printf("  %-10s worst error %d ticks, drift %d, %ld ms past the profile, %d timed out%s\n", plants[p].name,
+			worstError, worstDrift, worstOverrun, timeouts, plants[p].checked ? "" : " (for reference only)");
+	}
+	return ok;
+}
+
+const int turnAngles[] = { 50, 150, 450, 900, 1350, 1800, 3600, -150, -900, -1800 };
+#define N_TURN_ANGLES ((int)(sizeof(turnAngles) / sizeof(turnAngles[0])))
+
+int moveAngle;
+
+task turnMove() {
+	turnArbitraryAngle(moveAngle);
+}
+
+bool checkTurns() {
+	bool ok = true;
+
+	printf("turns: %d angles, settle within %d tenths and %d ms\n", N_TURN_ANGLES, turnTuning.tolerance, MAX_TURN_OVERRUN);
+	for(int p=0;p<N_PLANTS;p++) {
+		int worstError = 0, timeouts = 0;
+		long worstOverrun = 0;
+
+		for(int a=0;a<N_TURN_ANGLES;a++) {
+			moveAngle = turnAngles[a];
+			long took = runMove(&plants[p], turnMove);
+
+			profile_t profile;
+			profileInit(&profile, moveAngle, turnTuning.maxRate, turnTuning.accel);
+			long overrun = took - (long)(profile.tTotal * 1000);
+
+			int error = getGyroAngle() - moveAngle;
+			bool timedOut = (overrun >= turnTuning.timeoutMs);
+			bool slow = (overrun > MAX_TURN_OVERRUN);
+
+			worstError = (abs(error) > worstError) ? abs(error) : worstError;
+			worstOverrun = (overrun > worstOverrun) ? overrun : worstOverrun;
+			timeouts += timedOut ? 1 : 0;
+
+			if(plants[p].checked && (timedOut || slow || abs(error) > turnTuning.tolerance)) {
+				printf("  %s: turn %d: %ld ms (profile %.0f), error %d\n", plants[p].name,
+					moveAngle, took, profile.tTotal * 1000, error);
+				ok = false;
+			}
+		}
+
+		printf("  %-10s worst error %d tenths, %ld ms past the profile, %d timed out%s\n", plants[p].name,
+			worstError, worstOverrun, timeouts, plants[p].checked ? "" : " (for reference only)");
+	}
+	return ok;
+}
+
+int main() {
+	setTurnTuning(&turnTuning);
+
+	bool ok = checkStraightLines();
+	ok = checkTurns() && ok;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+/*
+ * ReplayCheck.c: host checks of the replay tools (ReplayLib.h,
+ * ReplayOptimize.c) that need to be run again whenever they change.
+ *
+ * Build:
+ *   g++ -x c++ -O2 -Wno-unknown-pragmas -IHost Host/ReplayCheck.c -o replay-check
+ *
+ * Usage:
+ *   replay-check
+ *
+ * Deadband: frameIdle(), and the optimizer's driveCommand() and
+ * scaleSticks(), against Akagi's own moveControl() on every value of each
+ * stick, the edge of the deadband included: a stick the drive ignores must
+ * count as idle, command nothing and be left alone when scaling, and one it
+ * doesn't must not.
+ *
+ * Long replays: two replays long enough to need chunk files, saved with
+ * hostSaveReplay() into one directory from sources with the same tag, must
+ * both load back from it, validate and decode to the frames saved.
+ *
+ * Exits with status 1 if any check fails.
+ */
+
+#include <unistd.h>
+
+#define REPLAY_CHECK
+#include "ReplayOptimize.c"
+
+bool akagiDriven() {
+	return motor[akagi::LFront] != 0 || motor[akagi::LBack] != 0 || motor[akagi::RFront] != 0 || motor[akagi::RBack] != 0;
+}
+
+bool checkDeadband() {
+	host_replay_t r;
+	memset(&r, 0, sizeof(r));
+	r.layout = findLayout(REPLAY_LAYOUT_AKAGI);
+	r.replay.frameSize = r.layout->nFields;
+	findFields(&r);
+
+	akagi::control_t state;
+	akagi::initState(&state);
+
+	long cases = 0, differ = 0;
+	int edge = 128;  /* smallest stick value the drive responds to */
+	for(int a=0;a<state.controls.nAxes;a++) {
+		for(int v=-128;v<=127;v++) {
+			/* The sticks come first in a frame, in map order. */
+			unsigned char frame[REPLAY_MAX_FRAME_SIZE], scaled[REPLAY_MAX_FRAME_SIZE];
+			memset(frame, 0, sizeof(frame));
+			frame[a] = (unsigned char)v;
+			memcpy(scaled, frame, sizeof(frame));
+			scaleSticks(&r, scaled, 0.5);
+
+			akagi::resetState(&state);
+			*state.controls.axes[a] = v;
+			akagi::moveControl(&state);
+			bool driven = akagiDriven();
+			if(driven && abs(v) < edge) {
+				edge = abs(v);
+			}
+
+			bool idle = frameIdle(r.layout, r.replay.frameSize, frame);
+			bool commands = driveCommand(&r, frame, 1.0) > 0;
+			bool scales = (scaled[a] != frame[a]);
+
+			cases++;
+			if(idle == driven || commands != driven || scales != driven) {
+				if(differ < 10) {
+					printf("  %s %d: moveControl %s, frameIdle %d, driveCommand %s, scaleSticks %s\n",
+						r.layout->fields[a].name, v, driven ? "drives" : "ignores it", idle,
+						commands ? "drives" : "idle", scales ? "scales it" : "leaves it");
+				}
+				differ++;
+			}
+		}
+	}
+
+	printf("deadband: %ld stick values, %ld disagree with moveControl (which responds from %d, deadband %d)\n",
+		cases, differ, edge, r.layout->deadband);
+	return differ == 0;
+}
+
+#define LONG_FRAMES 2000
+
+/* Sticks and buttons all over the place, so that the stream hardly packs. */
+void noisyFrames(unsigned char* frames, int count, int frameSize, unsigned int seed) {
+	srand(seed);
+	for(int i=0;i<count*frameSize;i++) {
+		frames[i] = (unsigned char)(rand() & 0xFF);
+	}
+}
+
+void removeDir(const char* dir) {
+	DIR* d = opendir(dir);
+	if(d == NULL) {
+		return;
+	}
+
+	struct dirent* ent;
+	while((ent = readdir(d)) != NULL) {
+		if(ent->d_name[0] != '.') {
+			char path[1024];
+			snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+			unlink(path);
+		}
+	}
+	closedir(d);
+	rmdir(dir);
+}
+
+bool checkLongReplays() {
+	char dir[] = "/tmp/replay-check.XXXXXX";
+	if(mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return false;
+	}
+
+	host_replay_t like;
+	memset(&like, 0, sizeof(like));
+	like.layout = findLayout(REPLAY_LAYOUT_SHIMAKAZE);
+	like.replay.frameSize = like.layout->nFields;
+	like.replay.frameHz = 50;
+	like.replay.tag = 0x1234;
+
+	const char* names[2] = { "long1", "long2" };
+	int frameSize = like.replay.frameSize;
+	unsigned char* frames[2];
+	bool ok = true;
+	for(int i=0;i<2;i++) {
+		frames[i] = (unsigned char*)malloc(LONG_FRAMES * frameSize);
+		noisyFrames(frames[i], LONG_FRAMES, frameSize, i + 1);
+		ok = hostSaveReplay(dir, names[i], &like, frames[i], LONG_FRAMES) && ok;
+	}
+
+	host_replay_t* list = NULL;
+	int count = 0, capacity = 0;
+	int failed = hostLoadReplayDir(dir, NULL, &list, &count, &capacity);
+	printf("long replays: %d saved into one directory (%d files), %d load back, %d fail\n", 2, hostFlashCount, count, failed);
+	ok = ok && failed == 0 && count == 2;
+
+	for(int i=0;i<count;i++) {
+		const char* name = strrchr(list[i].path, '/') + 1;
+		int which = (strcmp(name, names[0]) == 0) ? 0 : 1;
+
+		hostDecodeReplay(&list[i]);
+		bool same = list[i].replay.frameCount == LONG_FRAMES
+			&& memcmp(list[i].frames, frames[which], LONG_FRAMES * frameSize) == 0;
+		printf("  %s: %d chunks, %u frames, %s\n", name, list[i].replay.nChunks, list[i].replay.frameCount,
+			same ? "as saved" : "NOT as saved");
+		ok = ok && same && list[i].replay.nChunks >= 2;
+		free(list[i].frames);
+	}
+
+	free(list);
+	free(frames[0]);
+	free(frames[1]);
+	removeDir(dir);
+	return ok;
+}
+
+int main() {
+	bool ok = checkDeadband();
+	ok = checkLongReplays() && ok;
+	return ok ? 0 : 1;
+}
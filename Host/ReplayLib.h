@@ -0,0 +1,439 @@
+#ifndef REPLAYLIB_H
+#define REPLAYLIB_H
+
+/*
+ * ReplayLib.h: shared parts of the host replay tools (see ReplayTool.c).
+ *
+ * Knows the frame layout of each robot backend (from the backend's own
+ * bindControls()), and pulls every replay out of one or more directories of
+ * flash files (as written by the simulator's -f option, or copied off a
+ * robot) into memory.
+ *
+ * Each directory is loaded as a flash of its own, one after the other, so
+ * that chunk files ("rec0", ...) from different robots don't get mixed up.
+ * Loading goes through Enterprise's loadReplayFromFile(), and is not thread
+ * safe; checking (hostValidateReplay()) and decoding (hostDecodeReplay())
+ * a loaded replay only touch that replay and may run on any thread.
+ */
+
+#include "RobotC.h"
+
+void hostPlantStep(long) {}
+
+#include "../Enterprise.c"
+
+/* Field kinds. */
+#define FIELD_AXIS    0  /* signed stick value */
+#define FIELD_BUTTONS 1  /* one button per bit */
+#define FIELD_DELTA   2  /* signed sensor movement since the last frame */
+
+/*
+ * Each robot backend, in a namespace of its own, for the controls its
+ * bindControls() records and the constants it drives by. Ports as in the
+ * #pragma config block of the backend's Recorder.c.
+ */
+namespace akagi {
+#include "Robot3631A.h"
+#include "../3631A/Akagi.c"
+}
+
+namespace warspite {
+enum { pot = in1 };
+enum {
+	rightDrivea = port1, rightDriveb = port2, clawR = port3, ArmRb = port4, ArmRt = port5,
+	ArmLt = port6, ArmLa = port7, clawL = port8, leftDrivea = port9, leftDriveb = port10
+};
+#include "../3631/Warspite.c"
+}
+
+namespace shimakaze {
+enum { leftMotor = port1, clawMotor = port6, armMotor = port7, rightMotor = port10 }; // "RVW CLAWBOT"
+#include "../Testing/Shimakaze.c"
+}
+
+struct replay_field_t {
+	const char* name;
+	int kind;
+	const char* bits[8];  /* FIELD_BUTTONS: button on each bit, NULL if unused */
+};
+
+struct replay_layout_t {
+	int id;               /* REPLAY_LAYOUT_* */
+	const char* name;
+	int deadband;         /* sticks below this are idle (as in the backends) */
+	bool arcade;          /* sticks are forward/turn, not left/right */
+	int speedLimit;       /* largest drive motor command */
+	unsigned char stateButtons;  /* buttons driving a timed state machine */
+	int nFields;          /* frames may be shorter, e.g. open-loop Akagi replays */
+	replay_field_t fields[REPLAY_MAX_FRAME_SIZE];
+};
+
+/* Fields for the controls bound to `map`, in frame order (see control_map_t). */
+void layoutControls(replay_layout_t* layout, control_map_t* map) {
+	layout->nFields = 0;
+	for(int i=0;i<map->nAxes;i++) {
+		replay_field_t* field = &layout->fields[layout->nFields++];
+		field->name = map->axisNames[i];
+		field->kind = FIELD_AXIS;
+	}
+
+	for(int i=0;i<map->nButtons;i++) {
+		if((i & 7) == 0) {
+			replay_field_t* field = &layout->fields[layout->nFields++];
+			field->name = (i == 0) ? "buttons" : "buttons2";
+			field->kind = FIELD_BUTTONS;
+		}
+		layout->fields[layout->nFields - 1].bits[i & 7] = map->buttonNames[i];
+	}
+}
+
+/* A field the backend writes after its controls. */
+void layoutDelta(replay_layout_t* layout, const char* name) {
+	replay_field_t* field = &layout->fields[layout->nFields++];
+	field->name = name;
+	field->kind = FIELD_DELTA;
+}
+
+/* Mark the button called `name` as one that drives a timed state machine. */
+void layoutStateButton(replay_layout_t* layout, const char* name) {
+	for(int i=0;i<layout->nFields;i++) {
+		for(int b=0;b<8 && layout->fields[i].kind == FIELD_BUTTONS;b++) {
+			if(layout->fields[i].bits[b] != NULL && strcmp(layout->fields[i].bits[b], name) == 0) {
+				layout->stateButtons |= (1 << b);
+			}
+		}
+	}
+}
+
+#define N_REPLAY_LAYOUTS 3
+replay_layout_t replayLayouts[N_REPLAY_LAYOUTS];
+bool replayLayoutsBuilt = false;
+
+/*
+ * The frame layout of each backend, from its own bindControls(), so the
+ * tools read whatever it records.
+ */
+void buildLayouts() {
+	if(replayLayoutsBuilt) {
+		return;
+	}
+	replayLayoutsBuilt = true;
+	memset(replayLayouts, 0, sizeof(replayLayouts));
+
+	/*
+	 * Akagi's catapult buttons feed its catapult state machine, which also
+	 * moves on by itself on timers. Tracked frames carry the drive encoder
+	 * and gyro deltas after the controls (see addTrackedDeltas()).
+	 */
+	replay_layout_t* layout = &replayLayouts[0];
+	akagi::control_t akagiState;
+	akagi::bindControls(&akagiState);
+	layout->id = REPLAY_LAYOUT_AKAGI;
+	layout->name = "akagi";
+	layout->deadband = akagi::deadband;
+	layout->arcade = true;
+	layout->speedLimit = akagi::fastSpeedLimit;
+	layoutControls(layout, &akagiState.controls);
+	layoutDelta(layout, "left");
+	layoutDelta(layout, "right");
+	layoutDelta(layout, "heading");
+	layoutStateButton(layout, "catUp");
+	layoutStateButton(layout, "catDown");
+	layoutStateButton(layout, "catReset");
+
+	layout = &replayLayouts[1];
+	warspite::control_t warspiteState;
+	warspite::bindControls(&warspiteState);
+	layout->id = REPLAY_LAYOUT_WARSPITE;
+	layout->name = "warspite";
+	layout->deadband = warspite::deadband;
+	layout->speedLimit = warspiteState.speedLimit;
+	layoutControls(layout, &warspiteState.controls);
+
+	layout = &replayLayouts[2];
+	shimakaze::control_t shimakazeState;
+	shimakaze::bindControls(&shimakazeState);
+	layout->id = REPLAY_LAYOUT_SHIMAKAZE;
+	layout->name = "shimakaze";
+	layout->deadband = 25;
+	layout->speedLimit = 127;
+	layoutControls(layout, &shimakazeState.controls);
+}
+
+replay_layout_t* findLayout(int id) {
+	buildLayouts();
+	for(int i=0;i<N_REPLAY_LAYOUTS;i++) {
+		if(replayLayouts[i].id == id) {
+			return &replayLayouts[i];
+		}
+	}
+	return NULL;
+}
+
+replay_layout_t* findLayoutByName(const char* name) {
+	buildLayouts();
+	for(int i=0;i<N_REPLAY_LAYOUTS;i++) {
+		if(strcmp(replayLayouts[i].name, name) == 0) {
+			return &replayLayouts[i];
+		}
+	}
+	return NULL;
+}
+
+/* Number of fields of `layout` present in frames of `frameSize` bytes. */
+int layoutFields(replay_layout_t* layout, int frameSize) {
+	return (frameSize < layout->nFields) ? frameSize : layout->nFields;
+}
+
+/* Whether the drive ignores a stick at `value`, as moveControl() does. */
+bool stickIdle(replay_layout_t* layout, int value) {
+	return abs(value) < layout->deadband;
+}
+
+/* Whether a frame has no input in it (sensor deltas don't count). */
+bool frameIdle(replay_layout_t* layout, int frameSize, unsigned char* frame) {
+	int n = layoutFields(layout, frameSize);
+	for(int i=0;i<n;i++) {
+		int kind = layout->fields[i].kind;
+		if(kind == FIELD_AXIS && !stickIdle(layout, (signed char)frame[i])) {
+			return false;
+		} else if(kind == FIELD_BUTTONS && frame[i] != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+struct host_replay_t {
+	char path[1024];      /* directory/name */
+	replay_t replay;
+	replay_layout_t* layout;
+
+	bool corrupt;           /* set by hostValidateReplay() */
+
+	/* Filled in by hostDecodeReplay(). */
+	unsigned char* frames;  /* frameCount frames of replay.frameSize bytes */
+	bool decoded;
+};
+
+/* Whether `name` is a chunk file rather than a replay. */
+bool hostIsChunkName(const char* name) {
+	int n;
+	char extra;
+	return sscanf(name, "rec%d%c", &n, &extra) == 1;
+}
+
+/* Whether a later file in flash has the same name as file i. */
+bool hostFlashSuperseded(int i) {
+	for(int j=i+1;j<hostFlashCount;j++) {
+		if(strcmp(hostFlash[j].name, hostFlash[i].name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Whether any replay or chunk file in flash carries `tag`. */
+bool hostTagUsed(unsigned int tag) {
+	for(int i=0;i<hostFlashCount;i++) {
+		unsigned char* data = hostFlash[i].data;
+		int length = hostFlash[i].length;
+		if(hostIsChunkName(hostFlash[i].name)) {
+			if(length >= 2 && (unsigned int)(data[0] | (data[1] << 8)) == tag) {
+				return true;
+			}
+		} else if(length >= REPLAY_HEADER_SIZE && data[0] == REPLAY_MAGIC_0 && data[1] == REPLAY_MAGIC_1) {
+			if((unsigned int)(data[12] | (data[13] << 8)) == tag) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/* Check a loaded replay's CRC, frame count and keyframe index. */
+bool hostValidateReplay(host_replay_t* r) {
+	r->corrupt = !validateReplay(&r->replay);
+	if(r->corrupt) {
+		fprintf(stderr, "%s: corrupt (bad CRC, frame count or keyframe index)\n", r->path);
+	}
+	return !r->corrupt;
+}
+
+/*
+ * Load the replay called `name` from the flash currently loaded.
+ * `layout` overrides the layout recorded in the file (NULL = use the file's).
+ * Unless `validate` is false, the replay is checked too; otherwise the
+ * caller must hostValidateReplay() it before decoding it.
+ */
+bool hostLoadReplay(const char* dir, const char* name, replay_layout_t* layout, host_replay_t* out, bool validate = true) {
+	memset(out, 0, sizeof(host_replay_t));
+	snprintf(out->path, sizeof(out->path), "%s/%s", dir, name);
+
+	initReplayData(&out->replay);
+	loadReplayFromFile(name, &out->replay);
+	if(!out->replay.loaded) {
+		fprintf(stderr, "%s: not a replay, or chunks missing\n", out->path);
+		return false;
+	}
+
+	if(validate && !hostValidateReplay(out)) {
+		return false;
+	}
+
+	out->layout = (layout != NULL) ? layout : findLayout(out->replay.layout);
+	if(out->layout == NULL) {
+		fprintf(stderr, "%s: unknown frame layout %d (use -L)\n", out->path, out->replay.layout);
+		return false;
+	}
+
+	return true;
+}
+
+/* Make the contents of `dir` the flash that replays are loaded from. */
+int hostSelectFlashDir(const char* dir) {
+	hostFlashCount = 0;
+	fileIndexBuilt = false;
+
+	int n = hostFlashLoadDir(dir);
+	hostFlashDir = NULL; // read-only
+	return n;
+}
+
+/*
+ * Load every replay in `dir` and append it to `*list` (growing it as needed).
+ * Returns the number of files that looked like replays but couldn't be used.
+ * `validate` is as for hostLoadReplay().
+ */
+int hostLoadReplayDir(const char* dir, replay_layout_t* layout, host_replay_t** list, int* count, int* capacity, bool validate = true) {
+	if(hostSelectFlashDir(dir) < 0) {
+		fprintf(stderr, "could not read %s\n", dir);
+		return 1;
+	}
+
+	int failed = 0;
+	for(int i=0;i<hostFlashCount;i++) {
+		const char* name = hostFlash[i].name;
+		if(hostIsChunkName(name) || hostFlashSuperseded(i)) {
+			continue;
+		}
+
+		if(*count == *capacity) {
+			*capacity = *capacity ? (*capacity * 2) : 64;
+			*list = (host_replay_t*)realloc(*list, *capacity * sizeof(host_replay_t));
+		}
+
+		if(hostLoadReplay(dir, name, layout, &(*list)[*count], validate)) {
+			*count += 1;
+		} else {
+			failed++;
+		}
+	}
+
+	return failed;
+}
+
+/* Decode a loaded replay into plain frames. */
+void hostDecodeReplay(host_replay_t* r) {
+	replay_t probe;
+	memcpy(&probe, &r->replay, sizeof(replay_t));
+	rewindReplay(&probe);
+
+	int frameSize = probe.frameSize;
+	r->frames = (unsigned char*)malloc((probe.frameCount * frameSize) + 1);
+
+	for(unsigned int f=0;f<probe.frameCount;f++) {
+		for(int i=0;i<frameSize;i++) {
+			r->frames[(f * frameSize) + i] = readNextByte(&probe);
+		}
+	}
+
+	r->decoded = true;
+}
+
+unsigned char* hostFrame(host_replay_t* r, unsigned int f) {
+	return r->frames + (f * r->replay.frameSize);
+}
+
+/*
+ * Frames between keyframes in `r` as recorded, or one a second if it has
+ * too few to tell.
+ */
+int hostKeyframeInterval(host_replay_t* r) {
+	if(r->replay.nKeyframes >= 2) {
+		return keyframeFrame(&r->replay, 1) - keyframeFrame(&r->replay, 0);
+	}
+	return r->replay.frameHz;
+}
+
+/*
+ * Encode `count` frames in the format of `like` as a new replay called
+ * `name` in `dir`, with chunk files as needed. Files it replaces are kept
+ * as older copies (see FlashLib.h), and it gets a tag no file in `dir`
+ * has, so replays already in `dir` still load, as they would on the robot.
+ *
+ * `sourceFrames`, if not NULL, gives the frame of `like` that each frame
+ * was made from (NULL: frame for frame). Keyframes go wherever the backend
+ * state to store with them is known: for a layout without a state machine,
+ * every hostKeyframeInterval(like) frames; otherwise on each frame made
+ * from one of `like`'s keyframes, with the state recorded there.
+ */
+bool hostSaveReplay(const char* dir, const char* name, host_replay_t* like, unsigned char* frames, int count, int* sourceFrames = NULL) {
+	if(hostSelectFlashDir(dir) < 0) {
+		fprintf(stderr, "could not read %s\n", dir);
+		return false;
+	}
+	hostFlashDir = dir;
+
+	static unsigned char buffer[REPLAY_BUFFER_SIZE];
+	replay_t out;
+	int frameSize = like->replay.frameSize;
+	initReplayBuffer(&out, buffer, frameSize, like->layout->id);
+	setReplayFrameRate(&out, like->replay.frameHz);
+	out.tag = (like->replay.tag + 1) & 0xFFFF;
+	while(hostTagUsed(out.tag)) {
+		out.tag = (out.tag + 1) & 0xFFFF; // chunks are told apart by tag
+	}
+
+	/* Source keyframe at each source frame, or -1. */
+	int* sourceKey = (int*)malloc((like->replay.frameCount + 1) * sizeof(int));
+	for(unsigned int f=0;f<like->replay.frameCount;f++) {
+		sourceKey[f] = -1;
+	}
+	for(int k=0;k<like->replay.nKeyframes;k++) {
+		sourceKey[keyframeFrame(&like->replay, k)] = k;
+	}
+
+	bool stateMachine = (like->layout->stateButtons != 0);
+	setReplayKeyframeInterval(&out, stateMachine ? 0 : hostKeyframeInterval(like));
+	for(int f=0;f<count && !replayOverflowed(&out);f++) {
+		/* An interval of 1 makes this frame a keyframe, 0 doesn't. */
+		if(stateMachine) {
+			int k = sourceKey[(sourceFrames != NULL) ? sourceFrames[f] : f];
+			setReplayKeyframeInterval(&out, (k >= 0) ? 1 : 0);
+			if(k >= 0) {
+				memcpy(out.keyState, like->replay.keyIndex + (k * REPLAY_KEYFRAME_SIZE) + 4, REPLAY_KEY_STATE_SIZE);
+			}
+		}
+
+		for(int i=0;i<frameSize;i++) {
+			writeByte(&out, frames[(f * frameSize) + i]);
+		}
+		flushReplayChunk(&out); // no replayWriter task here
+	}
+	free(sourceKey);
+
+	int before = hostFlashCount;
+	if(!replayOverflowed(&out)) {
+		saveReplayToFile(name, &out);
+	}
+	hostFlashDir = NULL;
+
+	if(replayOverflowed(&out) || hostFlashCount == before || strcmp(hostFlash[hostFlashCount-1].name, name) != 0) {
+		fprintf(stderr, "%s/%s: could not save\n", dir, name);
+		return false;
+	}
+	return true;
+}
+
+#endif /* end of include guard: REPLAYLIB_H */
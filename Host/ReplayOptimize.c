@@ -0,0 +1,387 @@
+/*
+ * ReplayOptimize.c: make a recorded routine finish sooner.
+ *
+ * Build:
+ *   g++ -x c++ -O2 -IHost Host/ReplayOptimize.c -o replay-optimize
+ *
+ * Usage:
+ *   replay-optimize [-L layout] [-k ms] [-s ticks] [-x factor] [-v limit] dir/replay outdir [name]
+ *
+ * Writes a copy of the replay to `outdir` (under `name`, default the same
+ * name) with idle time taken out:
+ *
+ *  - idle frames (sticks in the deadband, no buttons) before the first input
+ *    are dropped;
+ *  - idle gaps between inputs, and the idle time after the last one, are cut
+ *    down to the -k margin (default 300 ms), which lets the drive coast to a
+ *    stop as it did while recording;
+ *  - idle frames within the margin before or after a press of a button that
+ *    feeds a timed state machine (Akagi's catapult) are always kept, so that
+ *    its timers run out exactly as they did while recording;
+ *  - for closed-loop replays, idle frames in which the robot was still
+ *    moving by more than -s ticks (default 1) are kept instead of using the
+ *    margin, and the movement in dropped frames is carried into the next one.
+ *
+ * With -x, stretches of drive-only input (no buttons) are also played
+ * `factor` times faster, with the sticks scaled up to match, wherever that
+ * keeps every drive motor command within the speed limit (-v, default the
+ * robot's). Check the result in the simulator: the drive doesn't respond
+ * linearly, so the path changes a little.
+ *
+ * The copy keeps a keyframe on every kept frame that was one in the original
+ * (see hostSaveReplay()), so it can still be started part way through.
+ */
+
+#include <getopt.h>
+
+#include "ReplayLib.h"
+
+struct opt_settings_t {
+	int margin;          /* frames */
+	int stillTolerance;  /* ticks per frame */
+	double factor;
+	int speedLimit;
+};
+
+struct opt_result_t {
+	int leading, trailing, gaps;  /* idle frames dropped */
+	int compressedIn, compressedOut;
+};
+
+/* Frame fields, by kind. */
+int axisField[REPLAY_MAX_FRAME_SIZE], nAxes = 0;
+int deltaField[REPLAY_MAX_FRAME_SIZE], nDeltas = 0;
+int buttonField = -1;
+
+void findFields(host_replay_t* r) {
+	int n = layoutFields(r->layout, r->replay.frameSize);
+	for(int i=0;i<n;i++) {
+		int kind = r->layout->fields[i].kind;
+		if(kind == FIELD_AXIS) {
+			axisField[nAxes++] = i;
+		} else if(kind == FIELD_DELTA) {
+			deltaField[nDeltas++] = i;
+		} else if(kind == FIELD_BUTTONS && buttonField < 0) {
+			buttonField = i;
+		}
+	}
+}
+
+int clampMagnitude(int x, int limit) {
+	return (x > limit) ? limit : ((x < -limit) ? -limit : x);
+}
+
+unsigned char frameButtons(unsigned char* frame) {
+	return (buttonField >= 0) ? frame[buttonField] : 0;
+}
+
+bool frameStill(unsigned char* frame, int tolerance) {
+	for(int i=0;i<nDeltas;i++) {
+		if(abs((signed char)frame[deltaField[i]]) > tolerance) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Sensor movement of frames that were dropped or merged is carried into the
+ * next frame written, a byte's worth at a time.
+ */
+int carry[REPLAY_MAX_FRAME_SIZE];
+
+void carryDeltas(unsigned char* frame) {
+	for(int i=0;i<nDeltas;i++) {
+		carry[i] += (signed char)frame[deltaField[i]];
+	}
+}
+
+void applyCarry(unsigned char* frame) {
+	for(int i=0;i<nDeltas;i++) {
+		int d = clampMagnitude(carry[i], 127);
+		frame[deltaField[i]] = (unsigned char)d;
+		carry[i] -= d;
+	}
+}
+
+/* Largest drive motor command the sticks in `frame` give, times `factor`. */
+double driveCommand(host_replay_t* r, unsigned char* frame, double factor) {
+	int value[2] = { 0, 0 };
+	for(int i=0;i<nAxes && i<2;i++) {
+		int v = (signed char)frame[axisField[i]];
+		value[i] = stickIdle(r->layout, v) ? 0 : v;
+	}
+
+	int a = value[0], b = value[1];
+	if(r->layout->arcade) {
+		a = value[0] + value[1];
+		b = value[0] - value[1];
+	}
+
+	return ((abs(a) > abs(b)) ? abs(a) : abs(b)) * factor;
+}
+
+void scaleSticks(host_replay_t* r, unsigned char* frame, double factor) {
+	for(int i=0;i<nAxes;i++) {
+		int v = (signed char)frame[axisField[i]];
+		if(!stickIdle(r->layout, v)) {
+			frame[axisField[i]] = (unsigned char)clampMagnitude((int)floor((v * factor) + 0.5), 127);
+		}
+	}
+}
+
+/*
+ * Pick the frames to keep. Returns the number kept, copied into `out` with
+ * the movement of dropped frames carried forward, and the frame each came
+ * from in `source`.
+ */
+int trimIdle(host_replay_t* r, opt_settings_t* s, unsigned char* out, int* source, opt_result_t* result) {
+	int frames = r->replay.frameCount;
+	int frameSize = r->replay.frameSize;
+	unsigned char stateButtons = r->layout->stateButtons;
+
+	int firstInput = frames, lastInput = -1;
+	for(int f=0;f<frames;f++) {
+		if(!frameIdle(r->layout, frameSize, hostFrame(r, f))) {
+			if(firstInput == frames) {
+				firstInput = f;
+			}
+			lastInput = f;
+		}
+	}
+
+	/* Distance to the nearest state machine button press before / after each frame. */
+	int* stateBefore = (int*)malloc((frames + 1) * sizeof(int));
+	int* stateAfter = (int*)malloc((frames + 1) * sizeof(int));
+	int last = -1000000;
+	for(int f=0;f<frames;f++) {
+		if(frameButtons(hostFrame(r, f)) & stateButtons) {
+			last = f;
+		}
+		stateBefore[f] = f - last;
+	}
+	last = 1000000;
+	for(int f=frames-1;f>=0;f--) {
+		if(frameButtons(hostFrame(r, f)) & stateButtons) {
+			last = f;
+		}
+		stateAfter[f] = last - f;
+	}
+
+	memset(carry, 0, sizeof(carry));
+
+	int kept = 0, sinceInput = 0;
+	for(int f=0;f<frames;f++) {
+		unsigned char* frame = hostFrame(r, f);
+		bool keep = true;
+
+		if(frameIdle(r->layout, frameSize, frame)) {
+			sinceInput++;
+
+			bool started = (f > firstInput);
+			bool settling = (nDeltas > 0) ? !frameStill(frame, s->stillTolerance) : (sinceInput <= s->margin);
+			bool timers = (stateBefore[f] <= s->margin) || (stateAfter[f] <= s->margin);
+
+			keep = timers || (started && settling);
+			if(!keep) {
+				if(f < firstInput) {
+					result->leading++;
+				} else if(f > lastInput) {
+					result->trailing++;
+				} else {
+					result->gaps++;
+				}
+			}
+		} else {
+			sinceInput = 0;
+		}
+
+		carryDeltas(frame);
+		if(keep) {
+			unsigned char* dest = out + (kept * frameSize);
+			memcpy(dest, frame, frameSize);
+			applyCarry(dest);
+			source[kept] = f;
+			kept++;
+		}
+	}
+
+	free(stateBefore);
+	free(stateAfter);
+	return kept;
+}
+
+/*
+ * Play drive-only stretches `factor` times faster: step through the frames
+ * at that rate, never skipping over any other frame. Returns the new count.
+ * `sourceIn` and `sourceOut` give the original frame of each frame.
+ */
+int compressTime(host_replay_t* r, opt_settings_t* s, unsigned char* in, int* sourceIn, int count, unsigned char* out, int* sourceOut, opt_result_t* result) {
+	int frameSize = r->replay.frameSize;
+
+	bool* fast = (bool*)malloc((count + 1) * sizeof(bool));
+	for(int f=0;f<count;f++) {
+		unsigned char* frame = in + (f * frameSize);
+		fast[f] = !frameIdle(r->layout, frameSize, frame) && frameButtons(frame) == 0 &&
+			driveCommand(r, frame, s->factor) <= s->speedLimit;
+	}
+
+	memset(carry, 0, sizeof(carry));
+
+	int written = 0;
+	int next = 0;     /* first frame not yet consumed */
+	double pos = 0;   /* playback position, in input frames */
+	while(next < count) {
+		int f = (int)pos;
+		if(f < next) {
+			f = next;
+			pos = next;
+		}
+
+		int end;
+		if(fast[f]) {
+			pos += s->factor;
+			end = (int)pos;
+			if(end <= f) {
+				end = f + 1;
+			}
+			for(int k=f+1;k<end && k<count;k++) {
+				if(!fast[k]) {
+					end = k;
+					pos = k;
+					break;
+				}
+			}
+		} else {
+			end = f + 1;
+			pos = end;
+		}
+		if(end > count) {
+			end = count;
+		}
+
+		for(int k=next;k<end;k++) {
+			carryDeltas(in + (k * frameSize));
+		}
+
+		unsigned char* dest = out + (written * frameSize);
+		memcpy(dest, in + (f * frameSize), frameSize);
+		if(fast[f]) {
+			scaleSticks(r, dest, s->factor);
+			result->compressedIn += end - next;
+			result->compressedOut++;
+		}
+		applyCarry(dest);
+		sourceOut[written] = sourceIn[f];
+
+		written++;
+		next = end;
+	}
+
+	free(fast);
+	return written;
+}
+
+#ifndef REPLAY_CHECK  /* Host/ReplayCheck.c has its own main() */
+void usage(const char* name) {
+	fprintf(stderr, "usage: %s [-L layout] [-k ms] [-s ticks] [-x factor] [-v limit] dir/replay outdir [name]\n", name);
+}
+
+int main(int argc, char** argv) {
+	opt_settings_t settings;
+	int marginMs = 300;
+	settings.stillTolerance = 1;
+	settings.factor = 1;
+	settings.speedLimit = -1;
+	replay_layout_t* layout = NULL;
+	int opt;
+
+	while((opt = getopt(argc, argv, "L:k:s:x:v:")) != -1) {
+		switch(opt) {
+		case 'L':
+			layout = findLayoutByName(optarg);
+			if(layout == NULL) {
+				fprintf(stderr, "unknown layout %s\n", optarg);
+				return 2;
+			}
+			break;
+		case 'k':
+			marginMs = atoi(optarg);
+			break;
+		case 's':
+			settings.stillTolerance = atoi(optarg);
+			break;
+		case 'x':
+			settings.factor = atof(optarg);
+			break;
+		case 'v':
+			settings.speedLimit = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if(argc - optind < 2 || argc - optind > 3 || settings.factor < 1) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	const char* path = argv[optind];
+	const char* outDir = argv[optind+1];
+
+	char dir[1024];
+	snprintf(dir, sizeof(dir), "%s", path);
+	char* slash = strrchr(dir, '/');
+	const char* name = (slash != NULL) ? (slash + 1) : dir;
+	if(slash != NULL) {
+		*slash = '\0';
+	}
+	const char* outName = (argc - optind == 3) ? argv[optind+2] : name;
+
+	host_replay_t replay;
+	if(hostSelectFlashDir((slash != NULL) ? dir : ".") < 0 || !hostLoadReplay((slash != NULL) ? dir : ".", name, layout, &replay)) {
+		fprintf(stderr, "could not load %s\n", path);
+		return 1;
+	}
+	hostDecodeReplay(&replay);
+	findFields(&replay);
+
+	settings.margin = (int)ceil(marginMs * replay.replay.frameHz / 1000.0);
+	if(settings.speedLimit < 0) {
+		settings.speedLimit = replay.layout->speedLimit;
+	}
+
+	int frames = replay.replay.frameCount;
+	int frameSize = replay.replay.frameSize;
+	unsigned char* trimmed = (unsigned char*)malloc((frames * frameSize) + 1);
+	unsigned char* result = (unsigned char*)malloc((frames * frameSize) + 1);
+	int* trimmedSource = (int*)malloc((frames + 1) * sizeof(int));
+	int* resultSource = (int*)malloc((frames + 1) * sizeof(int));
+
+	opt_result_t stats;
+	memset(&stats, 0, sizeof(stats));
+
+	int count = trimIdle(&replay, &settings, trimmed, trimmedSource, &stats);
+	if(settings.factor > 1) {
+		count = compressTime(&replay, &settings, trimmed, trimmedSource, count, result, resultSource, &stats);
+	} else {
+		memcpy(result, trimmed, count * frameSize);
+		memcpy(resultSource, trimmedSource, count * sizeof(int));
+	}
+
+	if(!hostSaveReplay(outDir, outName, &replay, result, count, resultSource)) {
+		return 1;
+	}
+
+	printf("%s: %d frames (%.2f s) -> %s/%s: %d frames (%.2f s)\n", path, frames, frames / (double)replay.replay.frameHz,
+		outDir, outName, count, count / (double)replay.replay.frameHz);
+	printf("idle frames dropped: %d leading, %d trailing, %d in gaps\n", stats.leading, stats.trailing, stats.gaps);
+	if(settings.factor > 1) {
+		printf("compressed %d frames into %d (x%.2f, limit %d)\n", stats.compressedIn, stats.compressedOut, settings.factor, settings.speedLimit);
+	}
+
+	return 0;
+}
+#endif /* REPLAY_CHECK */
@@ -0,0 +1,436 @@
+/*
+ * ReplayTool.c: look at replays without playing them.
+ *
+ * Build:
+ *   g++ -x c++ -O2 -pthread -IHost Host/ReplayTool.c -o replay-tool
+ *
+ * Usage:
+ *   replay-tool [-j jobs] [-L layout] dir ...          statistics for every replay
+ *   replay-tool -d [-L layout] [-n max] dir/a dir/b    frame-by-frame difference
+ *
+ * A directory holds the files of one robot's flash (replays named after
+ * their slot, plus chunk files). Statistics cover duration, idle time,
+ * button use and stick histograms; replays are checked and decoded in
+ * parallel on `jobs` threads (default: one per core). The frame layout comes from the
+ * replay header; -L akagi|warspite|shimakaze overrides it.
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "ReplayLib.h"
+
+#define HIST_BINS 8 /* stick histogram: 32 values per bin */
+
+struct replay_stats_t {
+	int idleFrames;
+	int leadingIdle, trailingIdle;
+	int longestGap;                         /* idle frames in a row, between inputs */
+	int presses[REPLAY_MAX_FRAME_SIZE][8];  /* button presses, per field and bit */
+	int held[REPLAY_MAX_FRAME_SIZE][8];     /* frames held down */
+	int hist[REPLAY_MAX_FRAME_SIZE][HIST_BINS];
+	long total[REPLAY_MAX_FRAME_SIZE];      /* sensor deltas: net movement */
+	int min[REPLAY_MAX_FRAME_SIZE], max[REPLAY_MAX_FRAME_SIZE];
+};
+
+host_replay_t* replays = NULL;
+replay_stats_t* stats = NULL;
+int nReplays = 0, replayCapacity = 0;
+
+double frameSeconds(host_replay_t* r, int frames) {
+	return frames / (double)r->replay.frameHz;
+}
+
+void computeStats(host_replay_t* r, replay_stats_t* s) {
+	memset(s, 0, sizeof(replay_stats_t));
+
+	int frameSize = r->replay.frameSize;
+	int nFields = layoutFields(r->layout, frameSize);
+	int frames = r->replay.frameCount;
+
+	for(int i=0;i<nFields;i++) {
+		s->min[i] = 127;
+		s->max[i] = -128;
+	}
+
+	int gap = 0;
+	bool seenInput = false;
+	unsigned char last[REPLAY_MAX_FRAME_SIZE];
+	memset(last, 0, sizeof(last));
+
+	for(int f=0;f<frames;f++) {
+		unsigned char* frame = hostFrame(r, f);
+
+		if(frameIdle(r->layout, frameSize, frame)) {
+			s->idleFrames++;
+			gap++;
+		} else {
+			if(!seenInput) {
+				s->leadingIdle = gap;
+			} else if(gap > s->longestGap) {
+				s->longestGap = gap;
+			}
+			seenInput = true;
+			gap = 0;
+		}
+
+		for(int i=0;i<nFields;i++) {
+			int value = (signed char)frame[i];
+			switch(r->layout->fields[i].kind) {
+			case FIELD_AXIS:
+				s->hist[i][(value + 128) / (256 / HIST_BINS)]++;
+				break;
+			case FIELD_BUTTONS:
+				for(int b=0;b<8;b++) {
+					if(TEST_BIT(frame[i], b)) {
+						s->held[i][b]++;
+						s->presses[i][b] += !TEST_BIT(last[i], b);
+					}
+				}
+				break;
+			case FIELD_DELTA:
+				s->total[i] += value;
+				break;
+			}
+
+			if(value < s->min[i]) {
+				s->min[i] = value;
+			}
+			if(value > s->max[i]) {
+				s->max[i] = value;
+			}
+		}
+
+		memcpy(last, frame, frameSize);
+	}
+
+	if(!seenInput) {
+		s->leadingIdle = frames;
+	} else {
+		s->trailingIdle = gap;
+	}
+}
+
+/* Worker threads take replays in turn until there are none left. */
+pthread_mutex_t nextLock = PTHREAD_MUTEX_INITIALIZER;
+int nextReplay = 0;
+
+void* statsWorker(void*) {
+	while(true) {
+		pthread_mutex_lock(&nextLock);
+		int i = nextReplay++;
+		pthread_mutex_unlock(&nextLock);
+
+		if(i >= nReplays) {
+			return NULL;
+		}
+
+		if(hostValidateReplay(&replays[i])) {
+			hostDecodeReplay(&replays[i]);
+			computeStats(&replays[i], &stats[i]);
+		}
+	}
+}
+
+void printStats(host_replay_t* r, replay_stats_t* s) {
+	int frames = r->replay.frameCount;
+	int nFields = layoutFields(r->layout, r->replay.frameSize);
+	replay_layout_t* layout = r->layout;
+
+	printf("== %s ==\n", r->path);
+	printf("layout %s, %d-byte frames, %d chunks, %d keyframes\n", layout->name, r->replay.frameSize, r->replay.nChunks, r->replay.nKeyframes);
+	printf("%d frames at %d Hz, %.2f s\n", frames, r->replay.frameHz, frameSeconds(r, frames));
+	printf("idle %.1f%% (%.2f s): leading %.2f s, trailing %.2f s, longest gap %.2f s\n",
+		frames ? (100.0 * s->idleFrames / frames) : 0.0, frameSeconds(r, s->idleFrames),
+		frameSeconds(r, s->leadingIdle), frameSeconds(r, s->trailingIdle), frameSeconds(r, s->longestGap));
+
+	for(int i=0;i<nFields;i++) {
+		replay_field_t* field = &layout->fields[i];
+		if(field->kind != FIELD_BUTTONS) {
+			continue;
+		}
+
+		printf("%-10s  %7s  %8s\n", "button", "presses", "held");
+		for(int b=0;b<8;b++) {
+			if(field->bits[b] != NULL) {
+				printf("%-10s  %7d  %6.2f s\n", field->bits[b], s->presses[i][b], frameSeconds(r, s->held[i][b]));
+			}
+		}
+	}
+
+	bool header = false;
+	for(int i=0;i<nFields;i++) {
+		if(layout->fields[i].kind != FIELD_AXIS) {
+			continue;
+		}
+
+		if(!header) {
+			printf("%-10s", "stick %");
+			for(int b=0;b<HIST_BINS;b++) {
+				printf(" %5d", -128 + (b * (256 / HIST_BINS)));
+			}
+			printf("   min  max\n");
+			header = true;
+		}
+
+		printf("%-10s", layout->fields[i].name);
+		for(int b=0;b<HIST_BINS;b++) {
+			printf(" %5.1f", frames ? (100.0 * s->hist[i][b] / frames) : 0.0);
+		}
+		printf("  %4d %4d\n", s->min[i], s->max[i]);
+	}
+
+	header = false;
+	for(int i=0;i<nFields;i++) {
+		if(layout->fields[i].kind != FIELD_DELTA) {
+			continue;
+		}
+
+		if(!header) {
+			printf("%-10s  %7s  %4s  %4s\n", "sensor", "net", "min", "max");
+			header = true;
+		}
+		printf("%-10s  %7ld  %4d  %4d\n", layout->fields[i].name, s->total[i], s->min[i], s->max[i]);
+	}
+
+	putchar('\n');
+}
+
+/* Returns the number of replays found corrupt. */
+int runStats(int jobs) {
+	stats = (replay_stats_t*)calloc(nReplays + 1, sizeof(replay_stats_t));
+
+	if(jobs > nReplays) {
+		jobs = nReplays;
+	}
+
+	pthread_t* threads = (pthread_t*)malloc((jobs + 1) * sizeof(pthread_t));
+	for(int t=0;t<jobs;t++) {
+		pthread_create(&threads[t], NULL, statsWorker, NULL);
+	}
+	for(int t=0;t<jobs;t++) {
+		pthread_join(threads[t], NULL);
+	}
+	free(threads);
+
+	double seconds = 0, idle = 0;
+	int corrupt = 0;
+	for(int i=0;i<nReplays;i++) {
+		if(replays[i].corrupt) {
+			corrupt++;
+			continue;
+		}
+
+		printStats(&replays[i], &stats[i]);
+		seconds += frameSeconds(&replays[i], replays[i].replay.frameCount);
+		idle += frameSeconds(&replays[i], stats[i].idleFrames);
+	}
+
+	printf("%d replays, %.2f s in total, %.1f%% idle\n", nReplays - corrupt, seconds,
+		(seconds > 0) ? (100.0 * idle / seconds) : 0.0);
+	return corrupt;
+}
+
+/* Load "dir/name" as replays[nReplays]. */
+bool loadReplayPath(const char* path, replay_layout_t* layout) {
+	char dir[1024];
+	snprintf(dir, sizeof(dir), "%s", path);
+
+	char* slash = strrchr(dir, '/');
+	const char* name = (slash != NULL) ? (slash + 1) : dir;
+	if(slash != NULL) {
+		*slash = '\0';
+	}
+
+	if(hostSelectFlashDir((slash != NULL) ? dir : ".") < 0) {
+		fprintf(stderr, "could not read the directory of %s\n", path);
+		return false;
+	}
+
+	if(nReplays == replayCapacity) {
+		replayCapacity += 2;
+		replays = (host_replay_t*)realloc(replays, replayCapacity * sizeof(host_replay_t));
+	}
+
+	if(!hostLoadReplay((slash != NULL) ? dir : ".", name, layout, &replays[nReplays])) {
+		return false;
+	}
+
+	hostDecodeReplay(&replays[nReplays]);
+	nReplays++;
+	return true;
+}
+
+void printFrame(host_replay_t* r, unsigned char* frame, int nFields) {
+	for(int i=0;i<nFields;i++) {
+		if(r->layout->fields[i].kind == FIELD_BUTTONS) {
+			printf(" %02x", frame[i]);
+		} else {
+			printf(" %4d", (signed char)frame[i]);
+		}
+	}
+}
+
+int runDiff(int maxShown) {
+	host_replay_t* a = &replays[0];
+	host_replay_t* b = &replays[1];
+
+	if(a->layout != b->layout) {
+		fprintf(stderr, "warning: comparing %s replay with %s replay\n", a->layout->name, b->layout->name);
+	}
+	if(a->replay.frameHz != b->replay.frameHz) {
+		fprintf(stderr, "warning: comparing %d Hz replay with %d Hz replay frame by frame\n", a->replay.frameHz, b->replay.frameHz);
+	}
+
+	int nFields = layoutFields(a->layout, a->replay.frameSize);
+	if(layoutFields(b->layout, b->replay.frameSize) < nFields) {
+		nFields = layoutFields(b->layout, b->replay.frameSize);
+	}
+
+	int framesA = a->replay.frameCount, framesB = b->replay.frameCount;
+	int common = (framesA < framesB) ? framesA : framesB;
+
+	int differing = 0, first = -1, shown = 0;
+	int fieldDiffs[REPLAY_MAX_FRAME_SIZE], maxDelta[REPLAY_MAX_FRAME_SIZE];
+	memset(fieldDiffs, 0, sizeof(fieldDiffs));
+	memset(maxDelta, 0, sizeof(maxDelta));
+
+	printf("--- %s (%d frames)\n+++ %s (%d frames)\n", a->path, framesA, b->path, framesB);
+
+	for(int f=0;f<common;f++) {
+		unsigned char* fa = hostFrame(a, f);
+		unsigned char* fb = hostFrame(b, f);
+
+		bool same = true;
+		for(int i=0;i<nFields;i++) {
+			if(fa[i] == fb[i]) {
+				continue;
+			}
+
+			same = false;
+			fieldDiffs[i]++;
+			if(a->layout->fields[i].kind != FIELD_BUTTONS) {
+				int delta = abs((signed char)fa[i] - (signed char)fb[i]);
+				if(delta > maxDelta[i]) {
+					maxDelta[i] = delta;
+				}
+			}
+		}
+
+		if(same) {
+			continue;
+		}
+
+		differing++;
+		if(first < 0) {
+			first = f;
+		}
+
+		if(shown < maxShown) {
+			printf("%6d %7.3f -", f, frameSeconds(a, f));
+			printFrame(a, fa, nFields);
+			printf("\n%6s %7s +", "", "");
+			printFrame(b, fb, nFields);
+			putchar('\n');
+			shown++;
+		}
+	}
+
+	if(differing > shown) {
+		printf("... %d more differing frames\n", differing - shown);
+	}
+
+	printf("%d of %d common frames differ", differing, common);
+	if(first >= 0) {
+		printf(", first at frame %d (%.3f s)", first, frameSeconds(a, first));
+	}
+	putchar('\n');
+
+	for(int i=0;i<nFields;i++) {
+		if(fieldDiffs[i] == 0) {
+			continue;
+		}
+
+		printf("  %-10s %6d frames", a->layout->fields[i].name, fieldDiffs[i]);
+		if(a->layout->fields[i].kind != FIELD_BUTTONS) {
+			printf(", by up to %d", maxDelta[i]);
+		}
+		putchar('\n');
+	}
+
+	if(framesA != framesB) {
+		printf("lengths differ by %d frames (%.3f s)\n", abs(framesA - framesB), frameSeconds(a, abs(framesA - framesB)));
+	}
+
+	return (differing > 0 || framesA != framesB) ? 1 : 0;
+}
+
+void usage(const char* name) {
+	fprintf(stderr, "usage: %s [-j jobs] [-L layout] dir ...\n", name);
+	fprintf(stderr, "       %s -d [-L layout] [-n max] dir/replay dir/replay\n", name);
+}
+
+int main(int argc, char** argv) {
+	bool diff = false;
+	int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int maxShown = 20;
+	replay_layout_t* layout = NULL;
+	int opt;
+
+	while((opt = getopt(argc, argv, "dj:L:n:")) != -1) {
+		switch(opt) {
+		case 'd':
+			diff = true;
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'L':
+			layout = findLayoutByName(optarg);
+			if(layout == NULL) {
+				fprintf(stderr, "unknown layout %s\n", optarg);
+				return 2;
+			}
+			break;
+		case 'n':
+			maxShown = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if(jobs < 1) {
+		jobs = 1;
+	}
+
+	if(diff) {
+		if(argc - optind != 2) {
+			usage(argv[0]);
+			return 2;
+		}
+		if(!loadReplayPath(argv[optind], layout) || !loadReplayPath(argv[optind+1], layout)) {
+			return 2;
+		}
+		return runDiff(maxShown);
+	}
+
+	if(optind >= argc) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	int failed = 0;
+	for(int i=optind;i<argc;i++) {
+		failed += hostLoadReplayDir(argv[i], layout, &replays, &nReplays, &replayCapacity, false);
+	}
+
+	failed += runStats(jobs);
+
+	if(failed > 0) {
+		fprintf(stderr, "%d files skipped\n", failed);
+	}
+	return 0;
+}
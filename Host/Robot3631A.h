@@ -0,0 +1,118 @@
+#ifndef ROBOT3631A_H
+#define ROBOT3631A_H
+
+/*
+ * Robot3631A.h: host port map and plant model for the 3631A robot (Akagi).
+ * Mirrors the #pragma config block at the top of 3631A/Recorder.c and
+ * 3631A/CompetitionControl.c, which g++ ignores.
+ */
+
+#include "RobotC.h"
+
+enum {
+	gyroSens = in1,
+	autoSelector = in2,
+	posSelector = in3,
+	catapultLim = dgtl1,
+	upperLim = dgtl2,
+	leftEnc = I2C_1,
+	rightEnc = I2C_2
+};
+
+enum {
+	RBack = port1,
+	RFront = port2,
+	rightLowerIntake = port3,
+	rightUpperIntake = port4,
+	hangMotor = port6,
+	leftUpperIntake = port7,
+	leftLowerIntake = port8,
+	LFront = port9,
+	LBack = port10
+};
+
+#define HOST_AUTO_SELECTOR autoSelector
+
+/*
+ * Plant model: each drive side is a first-order lag from motor command to
+ * wheel speed. Encoder and gyro signs match what CompetitionControl.c expects
+ * (leftEncCoeff = -1, rightEncCoeff = 1, gyroCoeff = -1).
+ */
+double hostDriveTicksPerMs = 1.05;   // IME ticks/ms at full power (393 high speed)
+double hostDriveTau = 80.0;          // ms
+double hostTurnTenthsPerTick = 0.64; // gyro tenths of a degree per differential encoder tick
+
+/* Per-side efficiency, to model a low battery or wheel slip (-p left=0.9). */
+double hostLeftGain = 1.0, hostRightGain = 1.0;
+
+extern int replayRate;     /* Akagi.c: replay playback speed in percent (-p rate=125) */
+extern int replayTickFreq; /* Akagi.c: replay control loop rate in Hz (-p tick=30) */
+extern long replayStartTime; /* Akagi.c: ms into the replay to start from (-p start=10000) */
+
+double hostLeftSpeed = 0, hostRightSpeed = 0;  // ticks/ms
+double hostLeftPos = 0, hostRightPos = 0;      // ticks
+double hostHeading = 0;                        // tenths of a degree
+
+int hostClampMotor(int v) {
+	return (v > 127) ? 127 : ((v < -127) ? -127 : v);
+}
+
+void hostRobotStep(long dt) {
+	double leftCmd = hostLeftGain * (hostClampMotor(motor[LFront]) + hostClampMotor(motor[LBack])) / 254.0;
+	double rightCmd = hostRightGain * (hostClampMotor(motor[RFront]) + hostClampMotor(motor[RBack])) / 254.0;
+
+	int lastLeft = (int)hostLeftPos;
+	int lastRight = (int)hostRightPos;
+	int lastHeading = (int)hostHeading;
+
+	for(long i=0;i<dt;i++) {
+		hostLeftSpeed += ((leftCmd * hostDriveTicksPerMs) - hostLeftSpeed) / hostDriveTau;
+		hostRightSpeed += ((rightCmd * hostDriveTicksPerMs) - hostRightSpeed) / hostDriveTau;
+
+		hostLeftPos += hostLeftSpeed;
+		hostRightPos += hostRightSpeed;
+		hostHeading += (hostLeftSpeed - hostRightSpeed) * hostTurnTenthsPerTick;
+	}
+
+	/* Apply deltas, so that code zeroing a sensor keeps working. */
+	SensorValue[leftEnc] += (int)hostLeftPos - lastLeft;
+	SensorValue[rightEnc] -= (int)hostRightPos - lastRight;
+	SensorValue[gyroSens] += (int)hostHeading - lastHeading;
+}
+
+/* Back to rest at the origin, so that runs can be compared. */
+void hostRobotReset() {
+	hostLeftSpeed = hostRightSpeed = 0;
+	hostLeftPos = hostRightPos = 0;
+	hostHeading = 0;
+	SensorValue[leftEnc] = SensorValue[rightEnc] = SensorValue[gyroSens] = 0;
+	motor[LFront] = motor[LBack] = motor[RFront] = motor[RBack] = 0;
+}
+
+bool hostRobotOption(const char* name, double value) {
+	if(strcmp(name, "left") == 0) {
+		hostLeftGain = value;
+	} else if(strcmp(name, "right") == 0) {
+		hostRightGain = value;
+	} else if(strcmp(name, "speed") == 0) {
+		hostDriveTicksPerMs = value;
+	} else if(strcmp(name, "tau") == 0) {
+		hostDriveTau = value;
+	} else if(strcmp(name, "rate") == 0) {
+		replayRate = (int)value;
+	} else if(strcmp(name, "tick") == 0) {
+		replayTickFreq = (int)value;
+	} else if(strcmp(name, "start") == 0) {
+		replayStartTime = (long)value;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+void hostRobotSummary(FILE* out) {
+	fprintf(out, "left enc: %d\nright enc: %d\ngyro: %d\n",
+		SensorValue[leftEnc], SensorValue[rightEnc], SensorValue[gyroSens]);
+}
+
+#endif /* end of include guard: ROBOT3631A_H */
@@ -0,0 +1,317 @@
+#ifndef ROBOTC_H
+#define ROBOTC_H
+
+/*
+ * RobotC.h: host-side stand-in for the parts of the ROBOTC runtime that the
+ * Enterprise / Akagi sources use, so that they can be compiled with g++ and run
+ * on Linux against a virtual clock.
+ *
+ * Time never passes on its own: it only advances when every running task is
+ * asleep, at which point the clock jumps straight to the earliest wakeup.
+ * A 60-second replay therefore runs in however long the control code itself
+ * takes to execute (usually a few milliseconds).
+ *
+ * Tasks are cooperative (one ucontext per task). A task that loops without
+ * ever calling sleep() will hang the simulator, just like it would starve
+ * every other task on the Cortex.
+ *
+ * This file is never seen by ROBOTC; see the README for build instructions.
+ */
+
+#define ROBOTC_HOST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <ucontext.h>
+
+#pragma GCC diagnostic ignored "-Wwrite-strings"
+
+/* Language bits. */
+#define task void
+typedef char string[20];
+
+#ifndef PI
+#define PI 3.14159265358979
+#endif
+
+inline int sgn(int x) { return (x > 0) - (x < 0); }
+inline int sgn(float x) { return (x > 0) - (x < 0); }
+
+/* Ports. */
+enum tMotor {
+	port1 = 0, port2, port3, port4, port5, port6, port7, port8, port9, port10,
+	kNumbOfRealMotors
+};
+
+enum tSensors {
+	in1 = 0, in2, in3, in4, in5, in6, in7, in8,
+	dgtl1, dgtl2, dgtl3, dgtl4, dgtl5, dgtl6, dgtl7, dgtl8, dgtl9, dgtl10, dgtl11, dgtl12,
+	I2C_1, I2C_2, I2C_3, I2C_4, I2C_5, I2C_6, I2C_7, I2C_8,
+	kNumbOfSensors
+};
+
+enum TVexJoysticks {
+	Ch1 = 0, Ch2, Ch3, Ch4,
+	Btn5D, Btn5U, Btn6D, Btn6U,
+	Btn7U, Btn7R, Btn7D, Btn7L,
+	Btn8U, Btn8R, Btn8D, Btn8L,
+	kNumbOfVexRTValues
+};
+
+enum TTimers { T1 = 0, T2, T3, T4, kNumbOfTimers };
+
+int motor[kNumbOfRealMotors];
+int SensorValue[kNumbOfSensors];
+int vexRT[kNumbOfVexRTValues];
+#define sensorValue SensorValue
+
+/* Virtual clock, in milliseconds since program start. */
+long hostClock = 0;
+#define nSysTime hostClock
+#define nPgmTime hostClock
+
+long hostTimerBase[kNumbOfTimers];
+
+struct host_timers_t {
+	long operator[](int t) const { return hostClock - hostTimerBase[t]; }
+};
+host_timers_t time1;
+
+void clearTimer(int t) {
+	hostTimerBase[t] = hostClock;
+}
+
+/* Competition state. */
+bool bStopTasksBetweenModes = true;
+bool bIfiAutonomousMode = false;
+bool bIfiRobotDisabled = false;
+
+/* Hook for simulation code to keep sensors moving as the clock advances. */
+void hostPlantStep(long dt);
+
+/*
+ * Cooperative task scheduler.
+ */
+#define HOST_MAX_TASKS 16
+#define HOST_TASK_STACK (256 * 1024)
+
+struct host_task_t {
+	void (*entry)();
+	const char* name;
+	ucontext_t ctx;
+	char* stack;
+	long wake;
+	bool running;
+};
+
+host_task_t hostTasks[HOST_MAX_TASKS];
+ucontext_t hostSchedulerCtx;
+int hostCurrentTask = -1;
+
+void hostTaskTrampoline(int idx) {
+	hostTasks[idx].entry();
+	hostTasks[idx].running = false;
+	/* uc_link returns to the scheduler. */
+}
+
+int hostFindTask(void (*entry)()) {
+	for(int i=0;i<HOST_MAX_TASKS;i++) {
+		if(hostTasks[i].entry == entry && hostTasks[i].running) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void hostStartTask(void (*entry)(), const char* name) {
+	if(hostFindTask(entry) >= 0) {
+		return;
+	}
+
+	for(int i=0;i<HOST_MAX_TASKS;i++) {
+		if(!hostTasks[i].running) {
+			host_task_t* t = &hostTasks[i];
+			if(t->stack == NULL) {
+				t->stack = (char*)malloc(HOST_TASK_STACK);
+			}
+			t->entry = entry;
+			t->name = name;
+			t->wake = hostClock;
+			t->running = true;
+
+			getcontext(&t->ctx);
+			t->ctx.uc_stack.ss_sp = t->stack;
+			t->ctx.uc_stack.ss_size = HOST_TASK_STACK;
+			t->ctx.uc_link = &hostSchedulerCtx;
+			makecontext(&t->ctx, (void (*)())hostTaskTrampoline, 1, i);
+			return;
+		}
+	}
+
+	fprintf(stderr, "host: out of task slots starting %s\n", name);
+	exit(1);
+}
+
+void hostStopTask(void (*entry)()) {
+	int idx = hostFindTask(entry);
+	if(idx < 0) {
+		return;
+	}
+
+	hostTasks[idx].running = false;
+	if(idx == hostCurrentTask) {
+		swapcontext(&hostTasks[idx].ctx, &hostSchedulerCtx);
+	}
+}
+
+void hostStopAllTasks() {
+	for(int i=0;i<HOST_MAX_TASKS;i++) {
+		hostTasks[i].running = false;
+	}
+}
+
+/* Priorities are accepted but ignored. */
+#define kLowPriority 0
+#define kDefaultTaskPriority 7
+#define kHighPriority 255
+
+#define startTask(t, ...) hostStartTask((t), #t)
+#define stopTask(t) hostStopTask(t)
+
+/* Tasks only switch in sleep(), so there is nothing to lock out. */
+#define hogCPU()
+#define releaseCPU()
+
+void hostSleep(long ms) {
+	if(hostCurrentTask < 0) {
+		/* Called outside of any task (e.g. from pre_auton): just advance. */
+		if(ms > 0) {
+			hostPlantStep(ms);
+			hostClock += ms;
+		}
+		return;
+	}
+
+	host_task_t* t = &hostTasks[hostCurrentTask];
+	t->wake = hostClock + (ms > 0 ? ms : 0);
+	swapcontext(&t->ctx, &hostSchedulerCtx);
+}
+
+#define sleep(ms) hostSleep((long)(ms))
+#define wait1Msec(ms) hostSleep((long)(ms))
+
+/*
+ * Run tasks until none are left or the clock reaches `until` (if > 0).
+ * Returns true if tasks were still running when time ran out.
+ */
+bool hostRunTasks(long until) {
+	while(true) {
+		int next = -1;
+		for(int i=0;i<HOST_MAX_TASKS;i++) {
+			if(hostTasks[i].running && (next < 0 || hostTasks[i].wake < hostTasks[next].wake)) {
+				next = i;
+			}
+		}
+
+		if(next < 0) {
+			return false;
+		}
+
+		long wake = hostTasks[next].wake;
+		if(until > 0 && wake >= until) {
+			if(until > hostClock) {
+				hostPlantStep(until - hostClock);
+				hostClock = until;
+			}
+			return true;
+		}
+
+		if(wake > hostClock) {
+			hostPlantStep(wake - hostClock);
+			hostClock = wake;
+		}
+
+		hostCurrentTask = next;
+		swapcontext(&hostSchedulerCtx, &hostTasks[next].ctx);
+		hostCurrentTask = -1;
+	}
+}
+
+/* LCD. */
+char hostLCD[2][17];
+bool hostEchoLCD = false;
+int nLCDButtons = 0;
+
+void hostLCDChanged(int line) {
+	if(hostEchoLCD) {
+		fprintf(stderr, "[%6ld] LCD%d |%-16s|\n", hostClock, line, hostLCD[line]);
+	}
+}
+
+void clearLCDLine(int line) {
+	memset(hostLCD[line], ' ', 16);
+	hostLCD[line][16] = '\0';
+	hostLCDChanged(line);
+}
+
+void displayLCDString(int line, int pos, const char* str) {
+	for(int i=0; str[i] != '\0' && (pos+i) < 16; i++) {
+		hostLCD[line][pos+i] = str[i];
+	}
+	hostLCDChanged(line);
+}
+
+void displayLCDCenteredString(int line, const char* str) {
+	int len = strlen(str);
+	clearLCDLine(line);
+	displayLCDString(line, (len < 16) ? (16 - len) / 2 : 0, str);
+}
+
+void displayLCDChar(int line, int pos, char c) {
+	if(pos >= 0 && pos < 16) {
+		hostLCD[line][pos] = c;
+		hostLCDChanged(line);
+	}
+}
+
+/* Negative width means zero-padded, as in ROBOTC. */
+void displayLCDNumber(int line, int pos, long n, int width = 0) {
+	char buf[24];
+	if(width < 0) {
+		snprintf(buf, sizeof(buf), "%0*ld", -width, n);
+	} else {
+		snprintf(buf, sizeof(buf), "%*ld", width, n);
+	}
+	displayLCDString(line, pos, buf);
+}
+
+/* Debug stream. */
+FILE* hostDebugStream = NULL;
+
+void writeDebugStream(const char* fmt, ...) {
+	if(hostDebugStream == NULL) {
+		return;
+	}
+
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(hostDebugStream, fmt, args);
+	va_end(args);
+}
+
+void writeDebugStreamLine(const char* fmt, ...) {
+	if(hostDebugStream == NULL) {
+		return;
+	}
+
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(hostDebugStream, fmt, args);
+	va_end(args);
+	fputc('\n', hostDebugStream);
+}
+
+#endif /* end of include guard: ROBOTC_H */
@@ -0,0 +1,235 @@
+/*
+ * TelemetryDecode.c: turn telemetry records in a captured debug stream
+ * (see "Telemetry" in Enterprise.c) back into readable tables.
+ *
+ * Build:
+ *   g++ -x c++ -O2 -IHost Host/TelemetryDecode.c -o telemetry-decode
+ *
+ * Usage:
+ *   telemetry-decode [-l] [capture.txt ...]     (default: stdin)
+ *
+ * Prints one table per record type, or with -l a single log in time order.
+ * Lines that aren't telemetry records are skipped.
+ */
+
+#include <getopt.h>
+
+#include "RobotC.h"
+
+void hostPlantStep(long) {}
+
+#include "../Enterprise.c"
+
+/*
+ * Field formats: 'd' signed, 'u' unsigned, 'x' hex, 's' the three fields
+ * together as a packed name (telemetryLogName), '-' unused.
+ */
+struct tlm_type_t {
+	int id;
+	const char* name;
+	const char* format;
+	const char* fields[3];
+};
+
+tlm_type_t tlmTypes[] = {
+	{ TLM_DROPPED,       "dropped",       "u--", { "records" } },
+	{ TLM_FRAME,         "frame",         "ddx", { "byte0", "byte1", "byte2" } },
+	{ TLM_FILES_INDEXED, "files indexed", "u--", { "files" } },
+	{ TLM_FILE_FOUND,    "file found",    "s--", { "name" } },
+	{ TLM_FILE_MISSING,  "file missing",  "s--", { "name" } },
+	{ TLM_CHUNK_MISSING, "chunk missing", "u--", { "chunk" } },
+	{ TLM_CHUNK_FAILED,  "chunk failed",  "ud-", { "chunk", "error" } },
+	{ TLM_SAVING,        "saving",        "uuu", { "frames", "chunks", "bytes" } },
+	{ TLM_SAVE_FAILED,   "save failed",   "d--", { "error" } },
+	{ TLM_SAVED,         "saved",         "---", { } },
+	{ TLM_READ_ONLY,     "read-only",     "---", { } },
+	{ TLM_LOADED,        "loaded",        "uuu", { "frames", "chunks", "bytes" } },
+	{ TLM_BAD_REPLAY,    "bad replay",    "uu-", { "check", "value" } },
+};
+
+#define N_TLM_TYPES ((int)(sizeof(tlmTypes) / sizeof(tlmTypes[0])))
+
+struct tlm_record_t {
+	int id;
+	long time;      /* ms, unwrapped */
+	unsigned int field[3];
+};
+
+tlm_record_t* records = NULL;
+int nRecords = 0, recordCapacity = 0;
+int skipped = 0;
+
+tlm_type_t* findType(int id) {
+	for(int i=0;i<N_TLM_TYPES;i++) {
+		if(tlmTypes[i].id == id) {
+			return &tlmTypes[i];
+		}
+	}
+	return NULL;
+}
+
+/* Records carry the low 16 bits of nSysTime; assume < 65 s between records. */
+long lastRaw = -1, epoch = 0;
+
+void readCapture(FILE* in) {
+	char line[256];
+
+	while(fgets(line, sizeof(line), in) != NULL) {
+		unsigned int id, time, a, b, c;
+		const char* p = line;
+		while(*p == ' ' || *p == '\t') {
+			p++;
+		}
+
+		if(sscanf(p, "T%2x %4x %4x %4x %4x", &id, &time, &a, &b, &c) != 5) {
+			skipped++;
+			continue;
+		}
+
+		if(lastRaw >= 0 && (long)time < lastRaw) {
+			epoch += 0x10000;
+		}
+		lastRaw = time;
+
+		if(nRecords == recordCapacity) {
+			recordCapacity = recordCapacity ? (recordCapacity * 2) : 1024;
+			records = (tlm_record_t*)realloc(records, recordCapacity * sizeof(tlm_record_t));
+		}
+
+		tlm_record_t* r = &records[nRecords++];
+		r->id = id;
+		r->time = epoch + time;
+		r->field[0] = a;
+		r->field[1] = b;
+		r->field[2] = c;
+	}
+}
+
+void formatField(char* out, size_t size, char format, tlm_record_t* r, int i) {
+	switch(format) {
+	case 'd':
+		snprintf(out, size, "%d", (int)(short)r->field[i]);
+		break;
+	case 'u':
+		snprintf(out, size, "%u", r->field[i]);
+		break;
+	case 'x':
+		snprintf(out, size, "0x%02x", r->field[i]);
+		break;
+	case 's': {
+		char name[7];
+		for(int k=0;k<6;k++) {
+			name[k] = (r->field[k/2] >> ((k & 1) * 8)) & 0xFF;
+		}
+		name[6] = '\0';
+		snprintf(out, size, "%s", name);
+		break;
+	}
+	default:
+		out[0] = '\0';
+	}
+}
+
+void printTables() {
+	for(int t=0;t<N_TLM_TYPES;t++) {
+		tlm_type_t* type = &tlmTypes[t];
+
+		int count = 0;
+		for(int i=0;i<nRecords;i++) {
+			count += (records[i].id == type->id);
+		}
+		if(count == 0) {
+			continue;
+		}
+
+		printf("== %s (%d) ==\n%10s", type->name, count, "time");
+		for(int f=0;f<3;f++) {
+			if(type->format[f] != '-') {
+				printf("  %10s", type->fields[f]);
+			}
+		}
+		putchar('\n');
+
+		for(int i=0;i<nRecords;i++) {
+			if(records[i].id != type->id) {
+				continue;
+			}
+
+			printf("%6ld.%03ld", records[i].time / 1000, records[i].time % 1000);
+			for(int f=0;f<3;f++) {
+				if(type->format[f] != '-') {
+					char text[32];
+					formatField(text, sizeof(text), type->format[f], &records[i], f);
+					printf("  %10s", text);
+				}
+			}
+			putchar('\n');
+		}
+		putchar('\n');
+	}
+}
+
+void printLog() {
+	for(int i=0;i<nRecords;i++) {
+		tlm_type_t* type = findType(records[i].id);
+
+		printf("%6ld.%03ld  ", records[i].time / 1000, records[i].time % 1000);
+		if(type == NULL) {
+			printf("%-14s %04x %04x %04x\n", "unknown", records[i].field[0], records[i].field[1], records[i].field[2]);
+			continue;
+		}
+
+		printf("%-14s", type->name);
+		for(int f=0;f<3;f++) {
+			if(type->format[f] != '-') {
+				char text[32];
+				formatField(text, sizeof(text), type->format[f], &records[i], f);
+				printf(" %s=%s", type->fields[f], text);
+			}
+		}
+		putchar('\n');
+	}
+}
+
+int main(int argc, char** argv) {
+	bool log = false;
+	int opt;
+
+	while((opt = getopt(argc, argv, "l")) != -1) {
+		switch(opt) {
+		case 'l':
+			log = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-l] [capture.txt ...]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind >= argc) {
+		readCapture(stdin);
+	}
+	for(int i=optind;i<argc;i++) {
+		FILE* in = fopen(argv[i], "r");
+		if(in == NULL) {
+			fprintf(stderr, "could not open %s\n", argv[i]);
+			return 1;
+		}
+		readCapture(in);
+		fclose(in);
+	}
+
+	int unknown = 0;
+	for(int i=0;i<nRecords;i++) {
+		unknown += (findType(records[i].id) == NULL);
+	}
+
+	if(log) {
+		printLog();
+	} else {
+		printTables();
+	}
+
+	fprintf(stderr, "%d records (%d of unknown type), %d other lines skipped\n", nRecords, unknown, skipped);
+	return 0;
+}
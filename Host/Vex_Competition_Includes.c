@@ -0,0 +1,134 @@
+#ifndef VEX_COMPETITION_INCLUDES_C
+#define VEX_COMPETITION_INCLUDES_C
+
+/*
+ * Vex_Competition_Includes.c: host replacement for the ROBOTC competition
+ * template. Picked up instead of the real one through -IHost, so the robot
+ * programs build unchanged.
+ *
+ * Runs pre_auton() and then the autonomous task on the virtual clock, and
+ * reports how long that took in simulated and in wall-clock time.
+ *
+ * Options:
+ *  -f <dir>   load replays from (and save replays to) <dir>
+ *  -a <n>     autonomous selector potentiometer value
+ *  -t <file>  write a CSV trace of every motor change to <file> ("-" = stdout)
+ *  -m <ms>    stop autonomous after <ms> simulated milliseconds (default 120000)
+ *  -p <k>=<v> set a plant model or robot parameter (see hostRobotOption())
+ *  -l         echo LCD updates to stderr
+ *  -d         echo the debug stream to stderr
+ */
+
+#include <getopt.h>
+#include <sys/time.h>
+
+#include "FlashLib.h"
+
+void pre_auton();
+task autonomous();
+task usercontrol();
+
+FILE* hostTrace = NULL;
+int hostTraceLast[kNumbOfRealMotors];
+
+void hostWriteTrace() {
+	if(memcmp(hostTraceLast, motor, sizeof(hostTraceLast)) == 0) {
+		return;
+	}
+	memcpy(hostTraceLast, motor, sizeof(hostTraceLast));
+
+	fprintf(hostTrace, "%ld", hostClock);
+	for(int i=0;i<kNumbOfRealMotors;i++) {
+		fprintf(hostTrace, ",%d", motor[i]);
+	}
+	fputc('\n', hostTrace);
+}
+
+void hostPlantStep(long dt) {
+	if(hostTrace != NULL) {
+		hostWriteTrace();
+	}
+	hostRobotStep(dt);
+}
+
+double hostWallMs() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000.0) + (tv.tv_usec / 1000.0);
+}
+
+int main(int argc, char** argv) {
+	long limit = 120000;
+	int opt;
+
+	while((opt = getopt(argc, argv, "f:a:t:m:p:ld")) != -1) {
+		switch(opt) {
+		case 'f':
+			if(hostFlashLoadDir(optarg) < 0) {
+				fprintf(stderr, "could not read %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'a':
+			SensorValue[HOST_AUTO_SELECTOR] = atoi(optarg);
+			break;
+		case 't':
+			hostTrace = (strcmp(optarg, "-") == 0) ? stdout : fopen(optarg, "w");
+			if(hostTrace == NULL) {
+				fprintf(stderr, "could not open %s\n", optarg);
+				return 1;
+			}
+			memset(hostTraceLast, 0xFF, sizeof(hostTraceLast));
+			break;
+		case 'm':
+			limit = atol(optarg);
+			break;
+		case 'p': {
+			char name[32];
+			double value;
+			if(sscanf(optarg, "%31[^=]=%lf", name, &value) != 2 || !hostRobotOption(name, value)) {
+				fprintf(stderr, "bad plant parameter %s\n", optarg);
+				return 1;
+			}
+			break;
+		}
+		case 'l':
+			hostEchoLCD = true;
+			break;
+		case 'd':
+			hostDebugStream = stderr;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-f dir] [-a selector] [-t trace.csv] [-m ms] [-p name=value] [-l] [-d]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	double start = hostWallMs();
+
+	pre_auton();
+
+	long autonStart = hostClock;
+	bIfiAutonomousMode = true;
+	startTask(autonomous);
+	bool timedOut = hostRunTasks(autonStart + limit);
+	hostStopAllTasks();
+
+	if(hostTrace != NULL) {
+		hostWriteTrace();
+		if(hostTrace != stdout) {
+			fclose(hostTrace);
+		}
+	}
+
+	double wall = hostWallMs() - start;
+	long simulated = hostClock - autonStart;
+
+	fprintf(stderr, "autonomous: %ld ms simulated%s, %.3f ms wall (%.0fx real time)\n",
+		simulated, timedOut ? " (timed out)" : "", wall, (wall > 0) ? (simulated / wall) : 0.0);
+	hostRobotSummary(stderr);
+
+	return 0;
+}
+
+#endif /* end of include guard: VEX_COMPETITION_INCLUDES_C */
@@ -0,0 +1,43 @@
+#ifndef GYROLIB2_C
+#define GYROLIB2_C
+
+/*
+ * gyroLib2.c: host stand-in for jpearman's gyroLib (RobotCLibs/gyroLib,
+ * kept outside this repository), with only what the robot programs use.
+ *
+ * The plant model already integrates the gyro into SensorValue, in tenths
+ * of a degree as a ROBOTC sensorGyro reads, so GyroInit() only starts a
+ * task that copies it into theGyro.
+ */
+
+typedef struct {
+	tSensors port;
+	float angle;      /* degrees, 0..360 */
+	float abs_angle;  /* degrees, unwrapped */
+	bool valid;
+} gyroData;
+
+gyroData theGyro;
+
+task GyroTask() {
+	while(true) {
+		theGyro.abs_angle = SensorValue[theGyro.port] / 10.0;
+		theGyro.angle = fmod(theGyro.abs_angle, 360.0);
+		if(theGyro.angle < 0) {
+			theGyro.angle += 360.0;
+		}
+		sleep(10);
+	}
+}
+
+void GyroInit(tSensors port) {
+	theGyro.port = port;
+	theGyro.valid = true;
+	startTask(GyroTask);
+}
+
+float GyroGetAngle() {
+	return theGyro.angle;
+}
+
+#endif /* end of include guard: GYROLIB2_C */
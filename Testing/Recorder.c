@@ -16,44 +16,61 @@
 #include "./Shimakaze.c"
 
 replay_t replay;
+unsigned char recordBuffer[REPLAY_BUFFER_SIZE];
 
 //void pre_auton() {}
 
 task autonomous() {
+	startTelemetry();
+
 	if(bIfiAutonomousMode) {
 	    control_t state;
 
+	    initState(&state);
 	    initReplayData(&replay);
 
-	    loadReplayFromFile("replay", &replay);
+	    loadReplayFromFile("replay", &replay, REPLAY_LAYOUT_SHIMAKAZE);
+
+	    ticker_t ticker;
+	    tickerStart(&ticker, snapshotFreq);
 
-	    while(1) {
+	    while(!replayFinished(&replay)) {
 	        replayToControl(&state, &replay);
 	        controlToMotors(state);
 
-	        sleep(deltaT);
+	        tickerWait(&ticker);
 	    }
 	  }
+
+	stopTelemetry();
 }
 
 task usercontrol() {
     control_t state;
 
-    initReplayData(&replay);
+    startTelemetry();
+
+    initState(&state);
+    initReplayBuffer(&replay, recordBuffer, REPLAY_FRAME_SIZE, REPLAY_LAYOUT_SHIMAKAZE);
+    startReplayWriter(&replay);
+
+    ticker_t ticker;
+    tickerStart(&ticker, snapshotFreq);
 
     while(1) {
         joystickToControl(&state);
         controlToMotors(state);
-        controlToReplay(state, &replay);
+        controlToReplay(&state, &replay);
 
-        if(vexRT[Btn7R]) {
+        if(vexRT[Btn7R] || replayOverflowed(&replay)) {
             break;
         }
 
-        sleep(deltaT);
+        tickerWait(&ticker);
     }
 
     stopAllMotorsCustom();
+    stopReplayWriter();
 
     bool doSave = false;
 	while(true) {
@@ -78,4 +95,5 @@ task usercontrol() {
 	}
 
     saveReplayToFile("replay", &replay);
+    stopTelemetry();
 }
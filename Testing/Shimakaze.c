@@ -13,8 +13,32 @@ struct control_t {
 
     bool open;
     bool close;
+
+    control_map_t controls; // see bindControls()
 };
 
+/* Replayed controls, in frame order: sticks, then buttons from bit 0 up. */
+void bindControls(control_t* state) {
+    control_map_t* map = &state->controls;
+    initControlMap(map);
+
+    mapAxis(map, "left", &state->left);
+    mapAxis(map, "right", &state->right);
+
+    mapButton(map, "up", &state->up);
+    mapButton(map, "down", &state->down);
+    mapButton(map, "open", &state->open);
+    mapButton(map, "close", &state->close);
+}
+
+void initState(control_t* state) {
+    bindControls(state);
+    state->left = 0;
+    state->right = 0;
+    state->up = state->down = false;
+    state->open = state->close = false;
+}
+
 void controlToMotors(const control_t state) {
     motor[leftMotor] = state.left;
     motor[rightMotor] = state.right;
@@ -48,30 +72,15 @@ void joystickToControl(control_t* state) {
 }
 
 void replayToControl(control_t* state, replay_t* replay) {
-    state->left = (signed char)readNextByte(replay);
-    state->right = (signed char)readNextByte(replay);
-
-    unsigned char btnState = readNextByte(replay);
-
-    writeDebugStreamLine("%d / %d / %d", state->left, state->right, btnState);
+    unsigned char frame[REPLAY_MAX_FRAME_SIZE];
+    readReplayFrame(replay, frame);
+    unpackControls(&state->controls, frame);
 
-    state->up = TEST_BIT(btnState, 0);
-    state->down = TEST_BIT(btnState, 1);
-    state->open = TEST_BIT(btnState, 2);
-    state->close = TEST_BIT(btnState, 3);
+    telemetryLog(TLM_FRAME, state->left, state->right, frame[2]);
 }
 
-void controlToReplay(const control_t state, replay_t* replay) {
-    writeByte(replay, (unsigned char)state.left);
-    writeByte(replay, (unsigned char)state.right);
-
-    unsigned char btnState = 0;
-    btnState |= (state.up ? 1 : 0) << 0;
-    btnState |= (state.down ? 1 : 0) << 1;
-    btnState |= (state.open ? 1 : 0) << 2;
-    btnState |= (state.close ? 1 : 0) << 3;
-
-    writeByte(replay, btnState);
+void controlToReplay(control_t* state, replay_t* replay) {
+    controlsToReplay(&state->controls, replay);
 }
 
 #endif /* end of include guard: SHIMAKAZE_C */